@@ -0,0 +1,241 @@
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "AddressCache.h"
+#include <Udb/Transaction.h>
+#include <Udb/Idx.h>
+#include <QSet>
+#include <QDir>
+#include <QFileInfo>
+#include "HeTypeDefs.h"
+#include "MailObj.h"
+using namespace He;
+
+AddressCache::AddressCache( Udb::Transaction* txn ):QObject( txn ),d_txn( txn ),d_hits(0),d_seeks(0),d_uses(0),d_writes(0)
+{
+	Q_ASSERT( txn != 0 );
+	txn->addObserver( this, SLOT(onDbUpdate( Udb::UpdateInfo ) ), false );
+}
+
+AddressCache* AddressCache::inst( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	AddressCache* c = txn->findChild<AddressCache*>();
+	if( c == 0 )
+		c = new AddressCache( txn );
+	return c;
+}
+
+Udb::Obj AddressCache::find( const QByteArray& key )
+{
+	if( key.isEmpty() )
+		return Udb::Obj();
+	QHash<QByteArray,Udb::OID>::const_iterator i = d_committed.find( key );
+	if( i != d_committed.end() )
+	{
+		d_hits++;
+		return d_txn->getObject( i.value() );
+	}
+	i = d_pending.find( key );
+	if( i != d_pending.end() )
+	{
+		// Nach einem Rollback existiert das Objekt nicht mehr oder die OID ist neu vergeben
+		Udb::Obj o = d_txn->getObject( i.value() );
+		if( !o.isNull( true ) && o.getType() == TypeEmailAddress &&
+				o.getValue( AttrEmailAddress ).getArr() == key )
+		{
+			d_hits++;
+			return o;
+		}
+		d_pending.remove( key );
+	}
+	return seek( key );
+}
+
+Udb::Obj AddressCache::seek( const QByteArray& key )
+{
+	d_seeks++;
+	Udb::Idx idx( d_txn, IndexDefs::IdxEmailAddress );
+	if( !idx.seek( Stream::DataCell().setLatin1( key, false ) ) )
+		return Udb::Obj(); // Fehlschläge merken wir nicht, der Aufrufer erstellt meist gleich die Adresse
+	Udb::Obj o = d_txn->getObject( idx.getOid() );
+	if( !o.isNull() )
+		d_committed[key] = o.getOid();
+	return o;
+}
+
+void AddressCache::insert( const QByteArray& key, const Udb::Obj& addrObj )
+{
+	if( key.isEmpty() || addrObj.isNull() )
+		return;
+	d_pending[key] = addrObj.getOid();
+}
+
+void AddressCache::clear()
+{
+	d_committed.clear();
+	d_pending.clear();
+}
+
+void AddressCache::touch( const Udb::Obj& addrObj )
+{
+	if( addrObj.isNull() )
+		return;
+	const QDateTime now = QDateTime::currentDateTime();
+	Usage& u = d_usage[addrObj.getOid()];
+	const double w = MailObj::getUseWeight( now.toUTC() );
+	u.d_frecency = ( u.d_count == 0 ) ? w : MailObj::addFrecency( u.d_frecency, w );
+	u.d_count++;
+	u.d_last = now;
+	d_uses++;
+}
+
+void AddressCache::flushUsage()
+{
+	if( d_usage.isEmpty() )
+		return;
+	// Kopie, da setValue über die Notifications wieder hier landen könnte
+	const QHash<Udb::OID,Usage> usage = d_usage;
+	d_usage.clear();
+	QHash<Udb::OID,Usage>::const_iterator i;
+	for( i = usage.begin(); i != usage.end(); ++i )
+	{
+		Udb::Obj o = d_txn->getObject( i.key() );
+		if( o.isNull( true ) )
+			continue; // in derselben Transaction gelöscht
+		MailObj::writeEmailAddressUse( o, i.value().d_count, i.value().d_last, i.value().d_frecency );
+		d_writes++;
+	}
+}
+
+void AddressCache::flushUsage( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	AddressCache* c = txn->findChild<AddressCache*>();
+	if( c )
+		c->flushUsage();
+}
+
+void AddressCache::discard( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	AddressCache* c = txn->findChild<AddressCache*>();
+	if( c )
+	{
+		c->d_pending.clear();
+		c->d_usage.clear();
+	}
+}
+
+void AddressCache::onDbUpdate( const Udb::UpdateInfo& info )
+{
+	if( info.d_kind != Udb::UpdateInfo::PreCommit )
+		return;
+	flushUsage(); // schon durch AddressIndexer erledigt, falls der zuerst dran war
+	const QList<Udb::UpdateInfo> updates = d_txn->getPendingNotifications();
+	QSet<Udb::OID> created;
+	if( !d_pending.isEmpty() )
+		created = QSet<Udb::OID>::fromList( d_pending.values() );
+	for( int i = 0; i < updates.size(); i++ )
+	{
+		const Udb::UpdateInfo& upd = updates[i];
+		if( ( upd.d_kind == Udb::UpdateInfo::ObjectErased && upd.d_name == TypeEmailAddress ) ||
+			( upd.d_kind == Udb::UpdateInfo::ValueChanged && upd.d_name == AttrEmailAddress &&
+			  !created.contains( upd.d_id ) ) )
+		{
+			// selten (RemoveDoubles, Adresse bearbeiten); der Cache füllt sich von selbst wieder
+			clear();
+			return;
+		}
+	}
+	// was bis hier überlebt hat, wird jetzt Teil der Datenbank
+	QHash<QByteArray,Udb::OID>::const_iterator j;
+	for( j = d_pending.begin(); j != d_pending.end(); ++j )
+		d_committed.insert( j.key(), j.value() );
+	d_pending.clear();
+}
+
+PendingCache::PendingCache( Udb::Transaction* txn ):QObject( txn )
+{
+	Q_ASSERT( txn != 0 );
+	txn->addObserver( this, SLOT(onDbUpdate( Udb::UpdateInfo ) ), false );
+}
+
+PendingCache* PendingCache::inst( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	PendingCache* c = txn->findChild<PendingCache*>();
+	if( c == 0 )
+		c = new PendingCache( txn );
+	return c;
+}
+
+void PendingCache::addMessage( const QByteArray& messageId, Udb::OID oid )
+{
+	if( !messageId.isEmpty() && !d_messages.contains( messageId ) )
+		d_messages.insert( messageId, oid );
+}
+
+void PendingCache::addDocument( const QByteArray& hash, Udb::OID oid )
+{
+	if( !hash.isEmpty() )
+		d_documents.insert( hash, oid );
+}
+
+void PendingCache::addMovedFile( const QString& from, const QString& to )
+{
+	Moved m;
+	m.d_from = from;
+	m.d_to = to;
+	d_moved.append( m );
+}
+
+void PendingCache::clear()
+{
+	d_messages.clear();
+	d_documents.clear();
+	d_moved.clear();
+}
+
+void PendingCache::discard( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	PendingCache* c = txn->findChild<PendingCache*>();
+	if( c == 0 )
+		return;
+	// Die Dokumente gibt es nicht mehr; ihre Dateien dorthin zurück, woher sie kamen, bzw.
+	// temporäre Dateien löschen, da deren Quelle (Mail oder eml-Datei) noch vorhanden ist.
+	const QString temp = QDir::temp().absolutePath();
+	for( int i = c->d_moved.size() - 1; i >= 0; i-- )
+	{
+		const Moved& m = c->d_moved[i];
+		if( QFileInfo( m.d_from ).absolutePath() == temp )
+			QFile::remove( m.d_to );
+		else
+			QFile::rename( m.d_to, m.d_from );
+	}
+	c->clear();
+}
+
+void PendingCache::onDbUpdate( const Udb::UpdateInfo& info )
+{
+	// ab jetzt in den Indizes zu finden, und die Dateien gehören den Dokumenten
+	if( info.d_kind == Udb::UpdateInfo::PreCommit )
+		clear();
+}
@@ -0,0 +1,112 @@
+#ifndef __He_AddressCache__
+#define __He_AddressCache__
+
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QHash>
+#include <QDateTime>
+#include <QList>
+#include <Udb/Obj.h>
+#include <Udb/UpdateInfo.h>
+
+namespace He
+{
+	// Zuordnung normalisierte Email-Adresse -> OID pro Transaction, für MailObj::getOrCreateEmailAddress.
+	// Enthält auch die in der laufenden Transaction erstellten Adressen, die über IdxEmailAddress erst
+	// nach dem Commit gefunden werden; darum können Accept und Import mehrere Mails pro Commit verarbeiten,
+	// ohne Adressen doppelt zu erstellen. Lebt als Kind der Transaction und wird mit ihr gelöscht.
+	class AddressCache : public QObject
+	{
+		Q_OBJECT
+	public:
+		static AddressCache* inst( Udb::Transaction* ); // erstellt den Cache beim ersten Aufruf
+		static QByteArray normalize( const QByteArray& addr ) { return addr.toLower().trimmed(); }
+
+		Udb::Obj find( const QByteArray& normalized );
+		void insert( const QByteArray& normalized, const Udb::Obj& addrObj ); // neu in dieser Transaction
+		void clear();
+		int getHits() const { return d_hits; }
+		int getSeeks() const { return d_seeks; }
+
+		// Verwendungen (AttrUseCount, AttrLastUse, AttrFrecency) werden pro Adresse gesammelt und
+		// erst in PreCommit einmal geschrieben; das Resultat ist dasselbe wie bei einzelnen Writes.
+		void touch( const Udb::Obj& addrObj );
+		void flushUsage(); // schreibt gesammelte Verwendungen in die Transaction
+		static void flushUsage( Udb::Transaction* ); // falls die Transaction einen Cache hat
+		static void discard( Udb::Transaction* ); // nach rollback aufrufen; vergisst alles Unbestätigte
+		int getUses() const { return d_uses; } // seit Start gezählte Verwendungen
+		int getWrites() const { return d_writes; } // dafür geschriebene Adressobjekte
+	protected slots:
+		void onDbUpdate( const Udb::UpdateInfo& );
+	protected:
+		explicit AddressCache( Udb::Transaction* );
+		Udb::Obj seek( const QByteArray& normalized );
+	private:
+		struct Usage
+		{
+			quint32 d_count;
+			QDateTime d_last;
+			double d_frecency; // nur die neuen Verwendungen
+			Usage():d_count(0),d_frecency(0){}
+		};
+		Udb::Transaction* d_txn;
+		QHash<QByteArray,Udb::OID> d_committed; // bestätigt durch Index oder Commit
+		QHash<QByteArray,Udb::OID> d_pending; // seit dem letzten Commit erstellt; nach Rollback ungültig
+		QHash<Udb::OID,Usage> d_usage;
+		int d_hits;
+		int d_seeks;
+		int d_uses;
+		int d_writes;
+	};
+
+	// Gegenstück für Messages und Dokumente: merkt sich, was in der laufenden Transaction erstellt
+	// wurde und darum in IdxMessageId bzw. IdxFileHash noch fehlt, damit Antworten und gleiche Anhänge
+	// innerhalb eines Import-Batches gefunden werden. Zudem die Dateien, die accept in den Dokument-
+	// speicher verschoben hat; discard() bringt sie nach einem Rollback zurück.
+	class PendingCache : public QObject
+	{
+		Q_OBJECT
+	public:
+		static PendingCache* inst( Udb::Transaction* );
+		Udb::OID findMessage( const QByteArray& messageId ) const { return d_messages.value( messageId ); }
+		void addMessage( const QByteArray& messageId, Udb::OID );
+		Udb::OID findDocument( const QByteArray& hash ) const { return d_documents.value( hash ); }
+		void addDocument( const QByteArray& hash, Udb::OID );
+		void addMovedFile( const QString& from, const QString& to ); // to liegt im Dokumentspeicher
+		static void discard( Udb::Transaction* ); // nach rollback aufrufen
+	protected slots:
+		void onDbUpdate( const Udb::UpdateInfo& );
+	protected:
+		explicit PendingCache( Udb::Transaction* );
+		void clear();
+	private:
+		struct Moved
+		{
+			QString d_from;
+			QString d_to;
+		};
+		QHash<QByteArray,Udb::OID> d_messages;
+		QHash<QByteArray,Udb::OID> d_documents;
+		QList<Moved> d_moved;
+	};
+}
+
+#endif // __He_AddressCache__
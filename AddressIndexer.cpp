@@ -20,23 +20,45 @@
 #include "AddressIndexer.h"
 #include <Udb/Transaction.h>
 #include <Udb/Idx.h>
+#include <QSet>
+#include <algorithm>
+#include <math.h>
 #include "HeTypeDefs.h"
 #include "ObjectHelper.h"
 #include <QtDebug>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QProgressDialog>
+#include <QApplication>
 #include "MailObj.h"
+#include "AddressCache.h"
 #include "HeraldApp.h"
 using namespace He;
 
 
+static const char* s_anchorUuid = "{5B0E7C21-94D3-4a6f-8E2B-C7A1D9F36E04}";
+static const char* s_slot2Uuid = "{9D4F2A63-1E87-4c05-B6D9-3F0A8C5E7B12}"; // Slot 1; Slot 0 ist s_addressIndex
+static const char* s_activeKey = "A"; // 0..s_addressIndex, 1..s_slot2Uuid
+static const int s_rebuildBatch = 2000; // Adressen pro Commit beim Rebuild
+static const int s_firstChunk = 8; // so viele Vorschläge liefert AddressLookup zuerst
+static const double s_minDice = 0.5; // schwächere Trigramm-Treffer werden nicht vorgeschlagen
+static const int s_minGramQuery = 4; // kürzere Eingaben nur als Präfix suchen
+
 AddressIndexer::AddressIndexer(Udb::Transaction * txn, QObject *parent) :
-    QObject(parent)
+    QObject(parent),d_ticket(0)
 {
+    d_trigrams = HeraldApp::inst()->getSet()->value( "AddressIndex/Trigrams", true ).toBool();
     Q_ASSERT( txn != 0 );
 
-    d_index = txn->getOrCreateObject( QUuid( HeraldApp::s_addressIndex ) );
+    d_anchor = txn->getOrCreateObject( QUuid( s_anchorUuid ) );
+    d_index = getSlot( true );
     txn->commit();
 	txn->setIndividualNotify(false);
     txn->addObserver( this, SLOT(onDbUpdate( Udb::UpdateInfo ) ), false );
+    loadTokens();
+    d_lookup = new AddressLookup( this );
+    connect( d_lookup, SIGNAL(sigReady()), this, SLOT(onLookupReady()), Qt::QueuedConnection );
+    d_lookup->start();
 //    Udb::Idx idx( txn, IndexDefs::IdxEmailAddress );
 //    if( idx.first() ) do
 //    {
@@ -45,6 +67,12 @@ AddressIndexer::AddressIndexer(Udb::Transaction * txn, QObject *parent) :
 //    }while( idx.next() );
 }
 
+AddressIndexer::~AddressIndexer()
+{
+    d_lookup->stop();
+    d_lookup->wait();
+}
+
 void AddressIndexer::test()
 {
     Udb::Idx idx( d_index.getTxn(), IndexDefs::IdxSentOn );
@@ -128,78 +156,354 @@ static QStringList _print( const Udb::Obj::KeyList& k )
     return l;
 }
 
-void AddressIndexer::indexAll(bool clear)
+static Stream::DataCell _getCell( const Udb::Obj& o, const QByteArray& key )
 {
-    if( clear )
+    // wie in NativeIndex; findCells liefert alle Schlüssel mit diesem Präfix, der kürzeste zuerst
+    Udb::Xit xit = o.findCells( key );
+    if( !xit.isNull() && xit.getKey() == key )
+        return xit.getValue();
+    return Stream::DataCell();
+}
+
+Udb::Obj AddressIndexer::getSlot( bool active ) const
+{
+    // Slot 0 ist das ursprüngliche Index-Objekt; so bleiben bestehende Repositories gültig
+    const quint32 a = _getCell( d_anchor, s_activeKey ).getUInt32() & 1;
+    const quint32 slot = ( active ) ? a : 1 - a;
+    return d_anchor.getTxn()->getOrCreateObject(
+                QUuid( ( slot == 0 ) ? HeraldApp::s_addressIndex : s_slot2Uuid ) );
+}
+
+namespace
+{
+    struct _AddrTokens
     {
-        Udb::Transaction* txn = d_index.getTxn();
-        d_index.erase();
-        txn->commit();
-        d_index = txn->getOrCreateObject( QUuid( HeraldApp::s_addressIndex ) );
-        txn->commit();
-    }else
+        Udb::OID d_oid;
+        QString d_addr;
+        QString d_name;
+        QList<QByteArray> d_keys; // collate der Tokens, vom _Tokenizer gesetzt
+    };
+
+    // Tokenisiert einen Teil des Batches; liest nicht aus Udb
+    class _Tokenizer : public QRunnable
+    {
+    public:
+        typedef QStringList (*Split)( const QString& );
+        _Tokenizer( QVector<_AddrTokens>& b, int from, int to, Split addr, Split name ):
+            d_batch( b ),d_from( from ),d_to( to ),d_splitAddr( addr ),d_splitName( name ) {}
+        void run()
+        {
+            for( int i = d_from; i < d_to; i++ )
+            {
+                _AddrTokens& a = d_batch[i];
+                const QStringList l = d_splitAddr( a.d_addr ) + d_splitName( a.d_name );
+                foreach( const QString& s, l )
+                {
+                    QByteArray key;
+                    Udb::Idx::collate( key, 0, s.toLower() );
+                    a.d_keys.append( key );
+                }
+            }
+        }
+    private:
+        QVector<_AddrTokens>& d_batch;
+        int d_from, d_to;
+        Split d_splitAddr, d_splitName;
+    };
+}
+
+bool AddressIndexer::rebuildIndex( QWidget* parent )
+{
+    Udb::Transaction* txn = getTxn();
+    // Überreste eines abgebrochenen Rebuilds entfernen
+    getSlot( false ).erase();
+    txn->commit();
+    d_building = getSlot( false );
+    txn->commit();
+
+    QList<Udb::OID> oids;
+    Udb::Idx idx( txn, IndexDefs::IdxEmailAddress );
+    if( idx.first() ) do
     {
-        Udb::Idx idx( d_index.getTxn(), IndexDefs::IdxEmailAddress );
-        if( idx.first() ) do
+        oids.append( idx.getOid() );
+    }while( idx.next() );
+
+    QApplication::setOverrideCursor( Qt::WaitCursor );
+    QProgressDialog progress( tr("Rebuilding address index..."), tr("Abort"), 0, oids.size(), parent );
+    progress.setMinimumDuration( 0 );
+    progress.setWindowTitle( tr( "Herald Addresses" ) );
+    progress.setWindowModality(Qt::WindowModal);
+
+    QThreadPool pool;
+    bool canceled = false;
+    for( int from = 0; from < oids.size() && !canceled; from += s_rebuildBatch )
+    {
+        const int to = qMin( oids.size(), from + s_rebuildBatch );
+        // Udb nur hier im GUI-Thread lesen
+        QVector<_AddrTokens> batch;
+        batch.reserve( to - from );
+        for( int i = from; i < to; i++ )
+        {
+            Udb::Obj addr = txn->getObject( oids[i] );
+            if( addr.isNull( true, true ) )
+                continue;
+            _AddrTokens t;
+            t.d_oid = oids[i];
+            t.d_addr = addr.getString( AttrEmailAddress );
+            t.d_name = addr.getValue( AttrText ).toString();
+            batch.append( t );
+        }
+        const int threads = qMax( 1, pool.maxThreadCount() );
+        const int slice = ( batch.size() + threads - 1 ) / threads;
+        for( int i = 0; i < batch.size(); i += slice )
+            pool.start( new _Tokenizer( batch, i, qMin( batch.size(), i + slice ), splitAddress, splitName ) );
+        pool.waitForDone();
+
+        for( int i = 0; i < batch.size(); i++ )
         {
-            Udb::Obj addr = d_index.getObject( idx.getOid() );
-//            qDebug() << "address:" << splitAddress( addr.getString( AttrEmailAddress ) );
-//            qDebug() << "name:" << splitName( addr.getString( AttrText ) );
-            addToIndex( splitAddress( addr.getString( AttrEmailAddress ) ), addr, clear );
-            addToIndex( splitName( addr.getValue( AttrText ).toString() ), addr, clear );
-        }while( idx.next() );
+            const Stream::DataCell v = Stream::DataCell().setOid( batch[i].d_oid );
+            const QByteArray oid = v.writeCell();
+            foreach( const QByteArray& key, batch[i].d_keys )
+                d_building.setCell( key + oid, v );
+        }
+        txn->commit();
+        progress.setValue( to );
+        canceled = progress.wasCanceled();
     }
-    d_index.commit();
+    QApplication::restoreOverrideCursor();
 
-//    Udb::Xit xit = d_index.findCells( QByteArray() );
-//    qDebug() << "****************** Index ********************";
-//    if( !xit.isNull() )do
-//    {
-//        qDebug() << "index:" << xit.getKey().toHex() << xit.getKey();
-//    }while( xit.nextKey() );
-//    qDebug() << "****************** End ********************";
+    if( canceled )
+    {
+        d_building.erase();
+        d_building = Udb::Obj();
+        txn->commit();
+        return false;
+    }
+    const quint32 a = _getCell( d_anchor, s_activeKey ).getUInt32() & 1;
+    d_anchor.setCell( QByteArray( s_activeKey ), Stream::DataCell().setUInt32( 1 - a ) );
+    Udb::Obj old = d_index;
+    d_index = d_building;
+    d_building = Udb::Obj();
+    old.erase(); // wird beim nächsten Rebuild neu angelegt
+    txn->commit();
+    loadTokens();
+    return true;
 }
 
-void AddressIndexer::clearIndex()
+bool AddressIndexer::Key::operator<( const Key& rhs ) const
 {
-    indexAll( true );
+    // NOTE: wie _lt; operator< von QByteArray ist wegen Nullzeichen im collate nicht brauchbar
+    const int n = memcmp( d_bytes.constData(), rhs.d_bytes.constData(),
+                          qMin( d_bytes.size(), rhs.d_bytes.size() ) );
+    if( n != 0 )
+        return n < 0;
+    return d_bytes.size() < rhs.d_bytes.size();
 }
 
-bool _compareLastUse(const Udb::Obj &o1, const Udb::Obj &o2)
+static bool _higherRank( const AddressIndexer::Ranked& lhs, const AddressIndexer::Ranked& rhs )
 {
-    return o1.getValue( AttrLastUse ).getDateTime() >= o2.getValue( AttrLastUse ).getDateTime();
+    if( lhs.d_match != rhs.d_match )
+        return lhs.d_match > rhs.d_match; // zuerst Präfix, dann Infix, dann ähnliche
+    if( lhs.d_rank != rhs.d_rank )
+        return lhs.d_rank > rhs.d_rank; // absteigend nach Frecency
+    return lhs.d_oid < rhs.d_oid;
 }
 
-QList<Udb::Obj> AddressIndexer::find( QString what, bool noObsoletes ) const
+bool AddressIndexer::match( const QString& str, bool noObsoletes, QVector<Ranked>& hits,
+                            const QAtomicInt* latest, quint32 ticket ) const
 {
-    bool sort = true;
+    QString what = str;
     if( what == QChar('*') )
-    {
-        sort = false;
         what.clear();
-    }
 
-    QList<Udb::Obj> res;
+    // Alles im RAM: Präfixbereich in d_tokens, Duplikate über QSet, Rang aus d_entries.
+    // Udb wird erst für die Resultate selbst gebraucht.
     QByteArray key;
     Udb::Idx::collate( key, 0, what.toLower() ); // Udb::IndexMeta::NFKD_CanonicalBase, what.toLower() );
-    Udb::Xit xit = d_index.findCells( key );
-    if( !xit.isNull() ) do
+    QSet<Udb::OID> seen;
+    int n = 0;
+    Tokens::const_iterator i = d_tokens.lowerBound( Key( key ) );
+    while( i != d_tokens.end() && i.key().d_bytes.startsWith( key ) )
+    {
+        if( latest != 0 && ( ++n & 0xff ) == 0 && quint32( latest->load() ) != ticket )
+            return false; // der User hat inzwischen weitergetippt
+        const QVector<Udb::OID>& oids = i.value();
+        for( int j = 0; j < oids.size(); j++ )
+        {
+            if( seen.contains( oids[j] ) )
+                continue;
+            seen.insert( oids[j] );
+            QHash<Udb::OID,Entry>::const_iterator e = d_entries.find( oids[j] );
+            if( e == d_entries.end() || ( noObsoletes && e.value().d_obsolete ) )
+                continue;
+            Ranked r;
+            r.d_match = 3;
+            r.d_rank = e.value().d_rank;
+            r.d_oid = oids[j];
+            hits.append( r );
+        }
+        ++i;
+    }
+    return matchGrams( what, noObsoletes, seen, hits, latest, ticket );
+}
+
+namespace
+{
+    struct _GramList
+    {
+        quint64 d_gram;
+        const QVector<quint64>* d_posts;
+        bool operator<( const _GramList& rhs ) const { return d_posts->size() < rhs.d_posts->size(); }
+    };
+}
+
+bool AddressIndexer::matchGrams( const QString& str, bool noObsoletes, QSet<Udb::OID>& seen,
+                                 QVector<Ranked>& hits, const QAtomicInt* latest, quint32 ticket ) const
+{
+    const QString what = str.toLower();
+    if( !d_trigrams || what.size() < s_minGramQuery )
+        return true;
+    const QVector<quint64> q = trigrams( what );
+
+    // Dice >= s_minDice verlangt mindestens minShared gemeinsame Trigramme; ein solcher Kandidat
+    // steht sicher in einer der q.size() - minShared + 1 kürzesten Posting-Listen.
+    const int minShared = qMax( 1, int( ::ceil( s_minDice * q.size() / ( 2.0 - s_minDice ) ) ) );
+    static const QVector<quint64> s_empty;
+    QVector<_GramList> lists( q.size() );
+    for( int i = 0; i < q.size(); i++ )
+    {
+        Grams::const_iterator g = d_grams.find( q[i] );
+        lists[i].d_gram = q[i];
+        lists[i].d_posts = ( g == d_grams.end() ) ? &s_empty : &g.value();
+    }
+    qSort( lists );
+    const int walked = q.size() - minShared + 1;
+    // Gemeinsame Trigramme pro Token schon beim Lesen zählen; ein Token steht pro Trigramm
+    // höchstens einmal in der Liste.
+    QHash<quint64,int> cands; // OID << 8 | Token -> gemeinsame Trigramme in den gelesenen Listen
+    int n = 0;
+    for( int i = 0; i < walked; i++ )
+    {
+        const QVector<quint64>& posts = *lists[i].d_posts;
+        for( int j = 0; j < posts.size(); j++ )
+        {
+            if( latest != 0 && ( ++n & 0xfff ) == 0 && quint32( latest->load() ) != ticket )
+                return false;
+            if( !seen.contains( posts[j] >> 8 ) )
+                cands[ posts[j] ]++;
+        }
+    }
+
+    // Die längeren Listen werden nicht gelesen; deren Trigramme im vorberechneten Set des Tokens
+    // nachschlagen.
+    QHash<Udb::OID,float> best;
+    QHash<quint64,int>::const_iterator c;
+    for( c = cands.begin(); c != cands.end(); ++c )
     {
-        if( xit.getValue().isOid() )
+        if( latest != 0 && ( ++n & 0xff ) == 0 && quint32( latest->load() ) != ticket )
+            return false;
+        const Udb::OID oid = c.key() >> 8;
+        const int t = c.key() & 0xff;
+        QHash<Udb::OID,Entry>::const_iterator e = d_entries.find( oid );
+        if( e == d_entries.end() || ( noObsoletes && e.value().d_obsolete ) ||
+                t >= e.value().d_grams.size() )
+            continue;
+        const QVector<quint64>& g = e.value().d_grams[t];
+        // Obergrenze, falls alle übrigen Trigramme auch vorkommen. Ein Infix in einem langen Token
+        // hat einen kleinen Dice, enthält aber alle Trigramme; diese Kandidaten nicht verwerfen.
+        const bool infix = c.value() == walked;
+        if( !infix && 2.0 * ( c.value() + q.size() - walked ) / double( q.size() + g.size() ) < s_minDice )
+            continue;
+        int shared = c.value();
+        for( int i = walked; i < q.size(); i++ )
+            if( qBinaryFind( g, lists[i].d_gram ) != g.constEnd() )
+                shared++;
+        float match = 0;
+        if( shared == q.size() && e.value().d_toks[t].contains( what ) )
+            match = 2;
+        else
         {
-            Udb::Obj o = d_index.getObject( xit.getValue().getOid() );
-            if( !o.isNull( true, true ) )
+            const double dice = 2.0 * shared / double( q.size() + g.size() );
+            if( dice >= s_minDice )
+                match = float( ::floor( dice * 10.0 ) / 10.0 ); // Stufen, innerhalb zählt Frecency
+        }
+        if( match > best.value( oid, 0 ) )
+            best[oid] = match;
+    }
+    QHash<Udb::OID,float>::const_iterator b;
+    for( b = best.begin(); b != best.end(); ++b )
+    {
+        seen.insert( b.key() );
+        Ranked r;
+        r.d_match = b.value();
+        r.d_rank = d_entries.value( b.key() ).d_rank;
+        r.d_oid = b.key();
+        hits.append( r );
+    }
+    return true;
+}
+
+QStringList AddressIndexer::gramTokens( const Entry& e )
+{
+    QStringList res = splitAddress( e.d_addr ) + splitName( e.d_name );
+    for( int i = 0; i < res.size(); i++ )
+        res[i] = res[i].toLower();
+    res.removeDuplicates();
+    return res;
+}
+
+QVector<quint64> AddressIndexer::trigrams( const QString& str )
+{
+    QVector<quint64> res;
+    for( int i = 0; i + 2 < str.size(); i++ )
+        res.append( ( quint64( str[i].unicode() ) << 32 ) | ( quint64( str[i+1].unicode() ) << 16 ) |
+                    str[i+2].unicode() );
+    qSort( res );
+    res.erase( std::unique( res.begin(), res.end() ), res.end() );
+    return res;
+}
+
+void AddressIndexer::addGrams( Udb::OID oid, const Entry& e, bool remove )
+{
+    // Aufrufer hält d_ramLock; e.d_grams kommt von updateEntry
+    for( int t = 0; t < e.d_grams.size(); t++ )
+    {
+        const quint64 post = ( quint64( oid ) << 8 ) | t;
+        const QVector<quint64>& g = e.d_grams[t];
+        for( int i = 0; i < g.size(); i++ )
+        {
+            if( remove )
             {
-                if( !noObsoletes || !o.getValue( AttrEmailObsolete ).getBool() )
-                {
-                    if( !res.contains(o) )
-                        res.append( o );
-                }
-            }
+                Grams::iterator j = d_grams.find( g[i] );
+                if( j == d_grams.end() )
+                    continue;
+                const int pos = j.value().indexOf( post );
+                if( pos != -1 )
+                    j.value().remove( pos );
+                if( j.value().isEmpty() )
+                    d_grams.erase( j );
+            }else
+                d_grams[ g[i] ].append( post );
         }
-    }while( xit.nextKey() );
-    if( sort )
-        qSort(res.begin(), res.end(), _compareLastUse ); // Sortiere absteigend nach LastUse
+    }
+}
+
+QList<Udb::Obj> AddressIndexer::find( QString what, bool noObsoletes, int limit ) const
+{
+    const bool sort = what != QChar('*');
+    QVector<Ranked> hits;
+    match( what, noObsoletes, hits );
+    if( limit > 0 && hits.size() > limit )
+    {
+        // Für kurze Präfixe wie "m" nur die angezeigten limit Treffer ordnen statt alle
+        std::partial_sort( hits.begin(), hits.begin() + limit, hits.end(), _higherRank );
+        hits.resize( limit );
+    }else if( sort )
+        qSort( hits.begin(), hits.end(), _higherRank );
+    QList<Udb::Obj> res;
+    res.reserve( hits.size() );
+    for( int j = 0; j < hits.size(); j++ )
+        res.append( d_index.getObject( hits[j].d_oid ) );
     return res;
 }
 
@@ -207,6 +511,8 @@ void AddressIndexer::onDbUpdate( const Udb::UpdateInfo& info )
 {
     if( info.d_kind != Udb::UpdateInfo::PreCommit )
         return;
+    // Verzögerte Verwendungszähler zuerst schreiben, damit sie unten in den Notifications sind
+    AddressCache::flushUsage( d_index.getTxn() );
     // mache hier eine richtige Kopie da durch die vorliegende Funktion die Notification List
     // ergänzt wird.
     QList<Udb::UpdateInfo> updates = d_index.getTxn()->getPendingNotifications();
@@ -215,7 +521,12 @@ void AddressIndexer::onDbUpdate( const Udb::UpdateInfo& info )
     {
         if( updates[i].d_kind == Udb::UpdateInfo::ValueChanged )
         {
-            if( updates[i].d_name == AttrEmailAddress )
+            if( updates[i].d_name == AttrFrecency || updates[i].d_name == AttrLastUse ||
+                    updates[i].d_name == AttrUseCount || updates[i].d_name == AttrEmailObsolete )
+            {
+                if( d_entries.contains( updates[i].d_id ) )
+                    updateEntry( d_index.getObject(updates[i].d_id) );
+            }else if( updates[i].d_name == AttrEmailAddress )
             {
                 Udb::Obj o = d_index.getObject(updates[i].d_id);
 
@@ -230,8 +541,22 @@ void AddressIndexer::onDbUpdate( const Udb::UpdateInfo& info )
                     addToIndex( splitName( o.getValue( AttrText, true ). // old value
                                                    toString() ), o, true );
                     addToIndex( splitName( o.getValue( AttrText ).toString() ), o );
+                }else if( o.getType() == TypePerson )
+                {
+                    // Personenname in den Einträgen der Adressen nachführen
+                    Udb::Obj addr = o.getFirstObj();
+                    if( !addr.isNull() ) do
+                    {
+                        if( addr.getType() == TypeEmailAddress && d_entries.contains( addr.getOid() ) )
+                            updateEntry( addr );
+                    }while( addr.next() );
                 }
             }
+        }else if( updates[i].d_kind == Udb::UpdateInfo::Aggregated )
+        {
+            // Adresse einer anderen Person zugeordnet
+            if( d_entries.contains( updates[i].d_id ) )
+                updateEntry( d_index.getObject(updates[i].d_id) );
         }else if( updates[i].d_kind == Udb::UpdateInfo::ObjectErased &&
                   updates[i].d_name == TypeEmailAddress )
         {
@@ -240,6 +565,14 @@ void AddressIndexer::onDbUpdate( const Udb::UpdateInfo& info )
                                            toString() ), o, true );
             addToIndex( splitName( o.getValue( AttrText, true ). // old value
                                            toString() ), o, true );
+            QWriteLocker lock( &d_ramLock );
+            QHash<Udb::OID,Entry>::iterator e = d_entries.find( o.getOid() );
+            if( e != d_entries.end() )
+            {
+                if( d_trigrams )
+                    addGrams( e.key(), e.value(), true );
+                d_entries.erase( e );
+            }
         }
     }
 
@@ -257,12 +590,237 @@ void AddressIndexer::addToIndex(const QStringList & l, const Udb::Obj & o, bool
     foreach(QString s, l )
     {
         Udb::Idx::collate( key, 0, s.toLower() ); //Udb::IndexMeta::NFKD_CanonicalBase, s.toLower() );
+        addToken( key, o.getOid(), remove );
         key += oid;
         d_index.setCell( key, v );
+        if( !d_building.isNull() )
+            d_building.setCell( key, v );
     }
+    if( !remove )
+        updateEntry( o );
     // qDebug() << ( (remove)?"remove":"add" ) << "index:" << v.toPrettyString() << l;
 }
 
+void AddressIndexer::addToken( const QByteArray& key, Udb::OID oid, bool remove )
+{
+    QWriteLocker lock( &d_ramLock );
+    if( remove )
+    {
+        Tokens::iterator i = d_tokens.find( Key( key ) );
+        if( i == d_tokens.end() )
+            return;
+        const int pos = i.value().indexOf( oid );
+        if( pos != -1 )
+            i.value().remove( pos );
+        if( i.value().isEmpty() )
+            d_tokens.erase( i );
+    }else
+    {
+        QVector<Udb::OID>& oids = d_tokens[ Key( key ) ];
+        if( !oids.contains( oid ) )
+            oids.append( oid );
+    }
+}
+
+void AddressIndexer::loadTokens()
+{
+    {
+        QWriteLocker lock( &d_ramLock );
+        d_tokens.clear();
+        d_entries.clear();
+        d_grams.clear();
+    }
+    // Schlüssel in d_index: collate(Token) + OID-Zelle; entfernte Einträge haben den Wert null
+    Udb::Xit xit = d_index.findCells( QByteArray() );
+    if( !xit.isNull() ) do
+    {
+        const Stream::DataCell v = xit.getValue();
+        if( v.isOid() )
+        {
+            const QByteArray oid = Stream::DataCell().setOid( v.getOid() ).writeCell();
+            const QByteArray key = xit.getKey();
+            if( key.endsWith( oid ) )
+            {
+                addToken( key.left( key.size() - oid.size() ), v.getOid(), false );
+                QWriteLocker lock( &d_ramLock );
+                d_entries.insert( v.getOid(), Entry() );
+            }
+        }
+    }while( xit.nextKey() );
+
+    // Sortierschlüssel einmal pro Adresse statt bei jedem Vergleich lesen
+    QList<Udb::OID> oids = d_entries.keys();
+    for( int i = 0; i < oids.size(); i++ )
+    {
+        Udb::Obj o = d_index.getObject( oids[i] );
+        if( o.isNull( true, true ) )
+        {
+            QWriteLocker lock( &d_ramLock );
+            d_entries.remove( oids[i] ); // find() ignoriert Tokens ohne Entry
+        }else
+            updateEntry( o );
+    }
+}
+
+void AddressIndexer::updateEntry( const Udb::Obj& o )
+{
+    Entry e;
+    e.d_rank = MailObj::getFrecency( o );
+    e.d_obsolete = o.getValue( AttrEmailObsolete ).getBool();
+    e.d_addr = o.getString( AttrEmailAddress );
+    e.d_name = o.getString( AttrText );
+    const Udb::Obj pers = o.getParent();
+    if( !pers.isNull() )
+        e.d_person = pers.getString( AttrText );
+    QWriteLocker lock( &d_ramLock );
+    Entry& cur = d_entries[ o.getOid() ];
+    if( d_trigrams && ( cur.d_addr != e.d_addr || cur.d_name != e.d_name ) )
+    {
+        // nur wenn sich der Text ändert, nicht bei jeder Verwendung der Adresse
+        e.d_toks = gramTokens( e );
+        for( int t = 0; t < e.d_toks.size() && t < 256; t++ )
+            e.d_grams.append( trigrams( e.d_toks[t] ) );
+        addGrams( o.getOid(), cur, true );
+        addGrams( o.getOid(), e, false );
+    }else
+    {
+        e.d_toks = cur.d_toks;
+        e.d_grams = cur.d_grams;
+    }
+    cur = e;
+}
+
+AddressIndexer::Suggestion AddressIndexer::toSuggestion( Udb::OID oid ) const
+{
+    Suggestion s;
+    QHash<Udb::OID,Entry>::const_iterator e = d_entries.find( oid );
+    if( e == d_entries.end() )
+    {
+        s.d_oid = 0; // inzwischen gelöscht
+        s.d_obsolete = true;
+        return s;
+    }
+    s.d_oid = oid;
+    s.d_addr = e.value().d_addr;
+    s.d_name = e.value().d_name;
+    s.d_person = e.value().d_person;
+    s.d_obsolete = e.value().d_obsolete;
+    return s;
+}
+
+quint32 AddressIndexer::findAsync( const QString& what, bool noObsoletes, int limit )
+{
+    d_ticket++;
+    if( d_ticket == 0 )
+        d_ticket++;
+    d_lookup->post( d_ticket, what, noObsoletes, limit );
+    return d_ticket;
+}
+
+void AddressIndexer::onLookupReady()
+{
+    QList<AddressLookup::Result> l = d_lookup->takeResults();
+    for( int i = 0; i < l.size(); i++ )
+    {
+        if( l[i].d_ticket == d_ticket ) // Resultate älterer Anfragen interessieren nicht mehr
+            emit sigFound( l[i].d_ticket, l[i].d_list, l[i].d_done );
+    }
+}
+
+AddressLookup::AddressLookup( AddressIndexer* idx ):QThread( idx ),d_idx( idx ),d_latest( 0 ),d_ticket( 0 ),
+    d_noObsoletes( false ),d_limit( 0 ),d_pending( false ),d_stop( false )
+{
+}
+
+void AddressLookup::post( quint32 ticket, const QString& what, bool noObsoletes, int limit )
+{
+    QMutexLocker lock( &d_lock );
+    d_ticket = ticket;
+    d_what = what;
+    d_noObsoletes = noObsoletes;
+    d_limit = limit;
+    d_pending = true;
+    d_latest.store( ticket ); // eine laufende Suche bricht beim nächsten Test ab
+    d_wake.wakeAll();
+}
+
+QList<AddressLookup::Result> AddressLookup::takeResults()
+{
+    QMutexLocker lock( &d_lock );
+    QList<Result> res = d_results;
+    d_results.clear();
+    return res;
+}
+
+void AddressLookup::stop()
+{
+    QMutexLocker lock( &d_lock );
+    d_stop = true;
+    d_latest.store( 0 );
+    d_wake.wakeAll();
+}
+
+void AddressLookup::run()
+{
+    forever
+    {
+        quint32 ticket;
+        QString what;
+        bool noObsoletes;
+        int limit;
+        {
+            QMutexLocker lock( &d_lock );
+            while( !d_pending && !d_stop )
+                d_wake.wait( &d_lock );
+            if( d_stop )
+                return;
+            ticket = d_ticket;
+            what = d_what;
+            noObsoletes = d_noObsoletes;
+            limit = d_limit;
+            d_pending = false;
+        }
+        QVector<AddressIndexer::Ranked> hits;
+        {
+            QReadLocker lock( &d_idx->d_ramLock );
+            if( !d_idx->match( what, noObsoletes, hits, &d_latest, ticket ) )
+                continue;
+        }
+        // Zuerst die besten paar, damit das Popup sofort etwas zeigt; dann der Rest bis limit
+        const int total = ( limit > 0 ) ? qMin( limit, hits.size() ) : hits.size();
+        const int first = qMin( s_firstChunk, total );
+        std::partial_sort( hits.begin(), hits.begin() + first, hits.end(), _higherRank );
+        deliver( ticket, hits, 0, first, first == total );
+        if( first < total && quint32( d_latest.load() ) == ticket )
+        {
+            std::partial_sort( hits.begin() + first, hits.begin() + total, hits.end(), _higherRank );
+            deliver( ticket, hits, first, total, true );
+        }
+    }
+}
+
+void AddressLookup::deliver( quint32 ticket, const QVector<AddressIndexer::Ranked>& hits, int from, int to,
+                             bool done )
+{
+    Result r;
+    r.d_ticket = ticket;
+    r.d_done = done;
+    {
+        QReadLocker lock( &d_idx->d_ramLock );
+        for( int i = from; i < to; i++ )
+        {
+            const AddressIndexer::Suggestion s = d_idx->toSuggestion( hits[i].d_oid );
+            if( s.d_oid != 0 )
+                r.d_list.append( s );
+        }
+    }
+    {
+        QMutexLocker lock( &d_lock );
+        d_results.append( r );
+    }
+    emit sigReady();
+}
+
 QStringList AddressIndexer::splitAddress(const QString & str)
 {
     QStringList addr = str.split( QChar('@') );
@@ -21,34 +21,149 @@
 */
 
 #include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QReadWriteLock>
+#include <QAtomicInt>
 #include <Udb/Obj.h>
 #include <Udb/UpdateInfo.h>
 
+class QWidget;
+
 namespace He
 {
+    class AddressLookup;
+
     class AddressIndexer : public QObject
     {
         Q_OBJECT
     public:
+        struct Suggestion // alles für die Anzeige, ohne Zugriff auf Udb
+        {
+            Udb::OID d_oid;
+            QString d_addr;
+            QString d_name; // AttrText oder leer
+            QString d_person; // AttrText der Person oder leer
+            bool d_obsolete;
+        };
+        typedef QList<Suggestion> Suggestions;
+        struct Ranked
+        {
+            float d_match; // 3..Präfix, 2..Infix, sonst Dice-Koeffizient der Trigramme
+            double d_rank;
+            Udb::OID d_oid;
+        };
+
         explicit AddressIndexer(Udb::Transaction*, QObject *parent = 0);
+        ~AddressIndexer();
 
         void test();
         void test2();
         void test3();
         void test4();
-        void indexAll(bool clear = false);
-        void clearIndex();
-        QList<Udb::Obj> find( QString, bool noObsoletes = false ) const;
+        // Baut den Index in den zweiten Slot, in Batches mit Commit und Fortschrittsanzeige; der
+        // bisherige Index bleibt bis zum Austausch in Gebrauch. false bei Abbruch.
+        bool rebuildIndex( QWidget* parent );
+        // limit > 0 liefert nur die besten limit Adressen, sortiert nach Frecency
+        QList<Udb::Obj> find( QString, bool noObsoletes = false, int limit = 0 ) const;
+        // Wie find, aber im AddressLookup-Thread; liefert die Ticketnummer der Anfrage. Eine neue
+        // Anfrage bricht die vorherige ab. Resultate kommen in Teilen über sigFound.
+        quint32 findAsync( const QString&, bool noObsoletes = false, int limit = 0 );
         Udb::Transaction* getTxn() const { return d_index.getTxn(); }
+    signals:
+        void sigFound( quint32 ticket, const AddressIndexer::Suggestions&, bool done );
     protected slots:
 		void onDbUpdate( const Udb::UpdateInfo& );
+        void onLookupReady();
     protected:
+        friend class AddressLookup;
+        struct Key
+        {
+            QByteArray d_bytes; // Udb::Idx::collate des Tokens, wie in d_index
+            Key( const QByteArray& b = QByteArray() ):d_bytes(b){}
+            bool operator<( const Key& ) const;
+        };
+        struct Entry
+        {
+            double d_rank; // MailObj::getFrecency, vorberechneter Sortierschlüssel
+            bool d_obsolete; // AttrEmailObsolete
+            QString d_addr;
+            QString d_name;
+            QString d_person; // für den Tooltip, nachgeführt bei Umbenennung und Zuordnung
+            QStringList d_toks; // gramTokens, nur mit d_trigrams
+            QVector<QVector<quint64> > d_grams; // trigrams pro Token, höchstens 256
+            Entry():d_rank(0),d_obsolete(false){}
+        };
+        typedef QMap<Key,QVector<Udb::OID> > Tokens;
+        typedef QHash<quint64,QVector<quint64> > Grams; // Trigramm -> OID << 8 | Index in gramTokens
+        // Sammelt die Treffer unsortiert; false wenn ticket nicht mehr *latest ist
+        bool match( const QString&, bool noObsoletes, QVector<Ranked>&,
+                    const QAtomicInt* latest = 0, quint32 ticket = 0 ) const;
+        bool matchGrams( const QString&, bool noObsoletes, QSet<Udb::OID>& seen, QVector<Ranked>&,
+                    const QAtomicInt* latest, quint32 ticket ) const;
+        void addGrams( Udb::OID, const Entry&, bool remove );
+        static QStringList gramTokens( const Entry& );
+        static QVector<quint64> trigrams( const QString& ); // sortiert, ohne Duplikate
+        Suggestion toSuggestion( Udb::OID ) const;
         void addToIndex( const QStringList&, const Udb::Obj&, bool remove = false );
-        QStringList splitAddress( const QString& addr );
-        QStringList splitName( const QString& name );
+        void addToken( const QByteArray&, Udb::OID, bool remove );
+        void loadTokens();
+        void updateEntry( const Udb::Obj& );
+        Udb::Obj getSlot( bool active ) const;
+        static QStringList splitAddress( const QString& addr );
+        static QStringList splitName( const QString& name );
     private:
+        Udb::Obj d_anchor; // Nummer des aktiven Slots
         Udb::Obj d_index;
         // Das ist ein Word-Index der Felder AttrEmailAddress und AttrText von TypeEmailAddress
+        Udb::Obj d_building; // während rebuildIndex der neue Slot; onDbUpdate schreibt in beide
+        Tokens d_tokens; // Kopie von d_index im RAM, sortiert für Präfixsuche
+        QHash<Udb::OID,Entry> d_entries; // alle indizierten Adressen
+        Grams d_grams; // nur mit d_trigrams; für Infix- und fehlertolerante Suche
+        mutable QReadWriteLock d_ramLock; // GUI-Thread schreibt d_tokens/d_entries, AddressLookup liest
+        AddressLookup* d_lookup;
+        quint32 d_ticket; // letzte Anfrage von findAsync
+        bool d_trigrams; // Setting "AddressIndex/Trigrams"
+    };
+
+    // Arbeitet nur auf dem RAM-Index des AddressIndexer, darum ohne eigene Transaction
+    class AddressLookup : public QThread
+    {
+        Q_OBJECT
+    public:
+        struct Result
+        {
+            quint32 d_ticket;
+            AddressIndexer::Suggestions d_list;
+            bool d_done;
+        };
+        AddressLookup( AddressIndexer* );
+        void post( quint32 ticket, const QString&, bool noObsoletes, int limit ); // ersetzt offene Anfrage
+        QList<Result> takeResults();
+        void stop();
+    signals:
+        void sigReady();
+    protected:
+        // Override
+        void run();
+        void deliver( quint32 ticket, const QVector<AddressIndexer::Ranked>&, int from, int to, bool done );
+    private:
+        AddressIndexer* d_idx;
+        QMutex d_lock;
+        QWaitCondition d_wake;
+        QAtomicInt d_latest; // Ticket der neuesten Anfrage; ältere brechen ab
+        quint32 d_ticket;
+        QString d_what;
+        bool d_noObsoletes;
+        int d_limit;
+        bool d_pending;
+        bool d_stop;
+        QList<Result> d_results;
     };
 }
 
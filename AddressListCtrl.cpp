@@ -30,19 +30,25 @@
 #include <QMimeData>
 #include <QApplication>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <Udb/Transaction.h>
 #include <Mail/MailMessage.h>
 #include <Udb/Idx.h>
 #include "HeTypeDefs.h"
 #include "AddressIndexer.h"
+#include "AddressCache.h"
+#include "MailObj.h"
 #include "HeraldApp.h"
 #include "PersonPropsDlg.h"
 #include "ObjectHelper.h"
 #include "PersonListView.h"
 using namespace He;
 
+static const int s_maxSuggestions = 50; // Zeilen im AddressSelectorPopup
+static const int s_doublesPerCommit = 200; // Gruppen pro Commit in onRemoveDoubles
+
 AddressListCtrl::AddressListCtrl(QWidget *parent) :
-    QObject(parent),d_showObsolete(false)
+    QObject(parent),d_ticket(0),d_showObsolete(false)
 {
     d_doSearch.setSingleShot(true);
     d_doSearch.setInterval( 300 );
@@ -65,6 +71,8 @@ AddressListCtrl *AddressListCtrl::create(QWidget *parent, AddressIndexer * idx)
 
     AddressListCtrl* ctrl = new AddressListCtrl(pane);
     ctrl->d_idx = idx;
+    connect( idx, SIGNAL(sigFound(quint32,AddressIndexer::Suggestions,bool)),
+             ctrl, SLOT(onFound(quint32,AddressIndexer::Suggestions,bool)) );
 
     ctrl->d_edit = new QLineEdit( pane );
     vbox->addWidget( ctrl->d_edit );
@@ -188,8 +196,7 @@ void AddressListCtrl::onRebuildIndex()
 {
     ENABLED_IF(true);
 
-    d_idx->indexAll(true);
-    d_idx->indexAll();
+    d_idx->rebuildIndex( getWidget() );
 }
 
 void AddressListCtrl::onCopy()
@@ -269,38 +276,216 @@ void AddressListCtrl::onAssignPerson()
     QApplication::restoreOverrideCursor();
 }
 
+struct _Doublette
+{
+    Udb::OID d_keep; // bleibt; die anderen werden auf ihn umgehängt und gelöscht
+    QList<Udb::OID> d_drop;
+    QByteArray d_key;
+    int d_idents; // weitere Adressen mit Identität; AttrIdentAddr ist unique, darum nicht vereint
+    int d_owners; // AttrSchedOwner auf einer der d_drop, werden auf d_keep umgehängt
+    _Doublette():d_keep(0),d_idents(0),d_owners(0){}
+};
+
+static int _countRefs( Udb::Idx& idx, const Udb::Obj& addr )
+{
+    int n = 0;
+    if( idx.seek( addr ) ) do
+    {
+        n++;
+    }while( idx.nextKey() );
+    return n;
+}
+
+static QByteArray _doubleKey( const Udb::Obj& addr )
+{
+    QByteArray key = AddressCache::normalize( addr.getValue( AttrEmailAddress ).getArr() );
+    if( key.startsWith( '<' ) && key.endsWith( '>' ) )
+        key = key.mid( 1, key.size() - 2 ).trimmed();
+    return key;
+}
+
+static bool _isBetterKeep( const Udb::Obj& a, const Udb::Obj& b )
+{
+    // Adressen mit Person gewinnen, dann die häufiger verwendete, dann die ältere
+    const bool pa = !a.getParent().isNull();
+    const bool pb = !b.getParent().isNull();
+    if( pa != pb )
+        return pa;
+    const quint32 ca = a.getValue( AttrUseCount ).getUInt32();
+    const quint32 cb = b.getValue( AttrUseCount ).getUInt32();
+    if( ca != cb )
+        return ca > cb;
+    return a.getOid() < b.getOid();
+}
+
 void AddressListCtrl::onRemoveDoubles()
 {
-    QList<QListWidgetItem *> l = d_list->selectedItems();
-    if( l.size() != 1 )
+    ENABLED_IF( true );
+
+    Udb::Transaction* txn = d_idx->getTxn();
+    QProgressDialog progress( tr("Searching double addresses..."), tr("Cancel"), 0, 0, getWidget() );
+    progress.setWindowTitle( tr("Remove Doublettes - Herald") );
+    progress.setWindowModality( Qt::WindowModal );
+    progress.setMinimumDuration( 500 );
+
+    // Ein Durchgang über den Index; die Gruppierung geschieht im RAM nach normalisiertem Schlüssel,
+    // damit auch Altlasten mit Grossbuchstaben, Leerzeichen oder <> zusammenfinden.
+    QHash<QByteArray,QList<Udb::OID> > groups;
+    Udb::Idx addrIdx( txn, IndexDefs::IdxEmailAddress );
+    int n = 0;
+    if( addrIdx.first() ) do
+    {
+        const Udb::Obj addr = txn->getObject( addrIdx.getOid() );
+        const QByteArray key = _doubleKey( addr );
+        if( !key.isEmpty() )
+            groups[key].append( addr.getOid() );
+        if( ++n % 1000 == 0 )
+        {
+            QApplication::processEvents();
+            if( progress.wasCanceled() )
+                return;
+        }
+    }while( addrIdx.next() );
+
+    QList<_Doublette> doubles;
+    int dropCount = 0, identCount = 0, ownerCount = 0;
+    Udb::Idx identIdx( txn, IndexDefs::IdxIdentAddr );
+    Udb::Idx ownerIdx( txn, IndexDefs::IdxSchedOwner );
+    QHash<QByteArray,QList<Udb::OID> >::const_iterator g;
+    for( g = groups.begin(); g != groups.end(); ++g )
+    {
+        if( g.value().size() < 2 )
+            continue;
+        // Eine Adresse mit Identität bleibt immer; gibt es mehrere, bleiben alle davon
+        QList<Udb::OID> idents;
+        foreach( Udb::OID oid, g.value() )
+            if( identIdx.seek( txn->getObject( oid ) ) )
+                idents.append( oid );
+        const QList<Udb::OID>& cands = ( idents.isEmpty() ) ? g.value() : idents;
+        _Doublette d;
+        d.d_key = g.key();
+        Udb::Obj keep = txn->getObject( cands.first() );
+        for( int i = 1; i < cands.size(); i++ )
+        {
+            Udb::Obj o = txn->getObject( cands[i] );
+            if( _isBetterKeep( o, keep ) )
+                keep = o;
+        }
+        d.d_keep = keep.getOid();
+        foreach( Udb::OID oid, g.value() )
+        {
+            if( oid == d.d_keep )
+                continue;
+            if( idents.contains( oid ) )
+                d.d_idents++;
+            else
+            {
+                d.d_drop.append( oid );
+                d.d_owners += _countRefs( ownerIdx, txn->getObject( oid ) );
+            }
+        }
+        if( d.d_drop.isEmpty() )
+        {
+            identCount += d.d_idents; // nur Adressen mit Identität, nichts zu vereinen
+            continue;
+        }
+        dropCount += d.d_drop.size();
+        identCount += d.d_idents;
+        ownerCount += d.d_owners;
+        doubles.append( d );
+    }
+    groups.clear();
+
+    if( doubles.isEmpty() )
+    {
+        QMessageBox::information( getWidget(), tr("Remove Doublettes - Herald"),
+                                  tr("No double addresses found in %1 addresses.").arg( n ) );
+        return;
+    }
+
+    // Probelauf: zeigen was passieren würde, ohne etwas zu ändern
+    QStringList details;
+    foreach( const _Doublette& d, doubles )
+    {
+        QString line = tr("%1: keep %2, join %3").arg( QString::fromLatin1( d.d_key ) ).
+                arg( d.d_keep ).arg( d.d_drop.size() );
+        if( d.d_owners > 0 )
+            line += tr(", move %1 schedule owners").arg( d.d_owners );
+        if( d.d_idents > 0 )
+            line += tr(", %1 identity addresses not joined").arg( d.d_idents );
+        details.append( line );
+    }
+    details.sort();
+    QString text = tr("%1 of %2 addresses are doubles in %3 groups.").arg( dropCount ).arg( n ).
+            arg( doubles.size() );
+    if( ownerCount > 0 )
+        text += QChar('\n') + tr("%1 schedules will be assigned to the kept address.").arg( ownerCount );
+    if( identCount > 0 )
+        text += QChar('\n') + tr("%1 addresses used by an identity are kept as they are.").arg( identCount );
+    QMessageBox box( QMessageBox::Question, tr("Remove Doublettes - Herald"),
+                     text + QChar('\n') + tr("Do you want to join them?"),
+                     QMessageBox::Yes | QMessageBox::No, getWidget() );
+    box.setDetailedText( details.join( QChar('\n') ) );
+    box.setDefaultButton( QMessageBox::No );
+    if( box.exec() != QMessageBox::Yes )
         return;
-    Udb::Obj addr = d_idx->getTxn()->getObject( l.first()->data(Qt::UserRole).toULongLong() );
-    ENABLED_IF( !addr.isNull() );
 
-    Udb::Idx addrIdx( d_idx->getTxn(), IndexDefs::IdxEmailAddress );
+    progress.reset();
+    progress.setLabelText( tr("Joining double addresses...") );
+    progress.setMaximum( doubles.size() );
     int dblCount = 0, updCount = 0;
-    if( addrIdx.seek( addr.getValue(AttrEmailAddress) ) ) do
+    for( int i = 0; i < doubles.size(); i++ )
     {
-        if( addrIdx.getOid() != addr.getOid() )
+        const _Doublette& d = doubles[i];
+        Udb::Obj keep = txn->getObject( d.d_keep );
+        foreach( Udb::OID oid, d.d_drop )
         {
-            Udb::Obj dbl = d_idx->getTxn()->getObject( addrIdx.getOid() );
-            // qDebug() << "Found doublette" << dbl.getOid();
-            Udb::Idx partyIdx( d_idx->getTxn(), IndexDefs::IdxPartyAddrDate );
+            Udb::Obj dbl = txn->getObject( oid );
+            if( dbl.isNull( true ) || identIdx.seek( dbl ) )
+                continue; // seit dem Probelauf einer Identität zugeordnet
+            // Parties zuerst sammeln, da das Umhängen den Index unter dem Cursor verändert
+            QList<Udb::OID> parties;
+            Udb::Idx partyIdx( txn, IndexDefs::IdxPartyAddrDate );
             if( partyIdx.seek( dbl ) ) do
             {
-                Udb::Obj party = d_idx->getTxn()->getObject( partyIdx.getOid() );
-//                qDebug() << "Used in" << HeTypeDefs::prettyName( party.getType() ) <<
-//                    party.getValue(AttrPartyDate).getDateTime() << party.getString( AttrText ) <<
-//                    party.getParent().getString( AttrText );
-                party.setValueAsObj( AttrPartyAddr, addr );
-                updCount++;
+                parties.append( partyIdx.getOid() );
             }while( partyIdx.nextKey() );
+            foreach( Udb::OID p, parties )
+                txn->getObject( p ).setValueAsObj( AttrPartyAddr, keep );
+            updCount += parties.size();
+            // ebenso die Kalender mit dieser Adresse als Besitzer
+            QList<Udb::OID> owned;
+            if( ownerIdx.seek( dbl ) ) do
+            {
+                owned.append( ownerIdx.getOid() );
+            }while( ownerIdx.nextKey() );
+            foreach( Udb::OID s, owned )
+                txn->getObject( s ).setValueAsObj( AttrSchedOwner, keep );
+            updCount += owned.size();
+
+            const quint32 uses = dbl.getValue( AttrUseCount ).getUInt32();
+            if( uses > 0 )
+            {
+                QDateTime last = dbl.getValue( AttrLastUse ).getDateTime();
+                const QDateTime keepLast = keep.getValue( AttrLastUse ).getDateTime();
+                if( !last.isValid() || ( keepLast.isValid() && keepLast > last ) )
+                    last = keepLast;
+                MailObj::writeEmailAddressUse( keep, uses, last, MailObj::getFrecency( dbl ) );
+            }
             dbl.erase();
             dblCount++;
         }
-    }while( addrIdx.nextKey() );
-    d_idx->getTxn()->commit();
-    QMessageBox::information( getWidget(), tr("Remove Doublettes"),
+        if( ( i + 1 ) % s_doublesPerCommit == 0 )
+        {
+            txn->commit();
+            progress.setValue( i + 1 );
+            if( progress.wasCanceled() )
+                break; // was bis hier committed ist, bleibt
+        }
+    }
+    txn->commit();
+    progress.reset();
+    QMessageBox::information( getWidget(), tr("Remove Doublettes - Herald"),
                               tr("%1 Roles updated, %2 double Addresses joined").arg( updCount).arg(dblCount ) );
 }
 
@@ -308,33 +493,45 @@ void AddressListCtrl::onSearch()
 {
     //qDebug() << "onSearch" << QTime::currentTime().toString("hh:mm:ss:zzz"); // TEST
     d_list->clear();
+    d_ticket = 0;
     if( d_edit->text().isEmpty() )
         return;
-    QList<Udb::Obj> res = d_idx->find( d_edit->text() );
+    d_ticket = d_idx->findAsync( d_edit->text(), !d_showObsolete );
+}
+
+void AddressListCtrl::onFound( quint32 ticket, const AddressIndexer::Suggestions& res, bool )
+{
+    if( ticket != d_ticket )
+        return;
     QFont strikeOut = d_list->font();
     strikeOut.setStrikeOut( true );
-    foreach( Udb::Obj o, res )
+    foreach( const AddressIndexer::Suggestion& s, res )
     {
-        const bool isObsolete = o.getValue( AttrEmailObsolete ).getBool();
-        if( !isObsolete || d_showObsolete )
-        {
-            QListWidgetItem* item = new QListWidgetItem( d_list );
-            QString addr = o.getString( AttrEmailAddress );
-            setName( item, o );
-            item->setData( Qt::UserRole, o.getOid() );
-            item->setIcon( QIcon( ":/images/at-sign-small.png") );
-            if( !MailMessage::isValidEmailAddress( addr.toLatin1() ) )
-                item->setBackground( Qt::red );
-            if( isObsolete )
-                item->setFont( strikeOut );
-        }
+        QListWidgetItem* item = new QListWidgetItem( d_list );
+        if( s.d_name.isEmpty() )
+            item->setText( s.d_addr );
+        else
+            item->setText( tr("%1 [%2]").arg(s.d_name).arg(s.d_addr) );
+        // wie setName, aber mit dem Personennamen aus dem RAM-Index
+        if( s.d_person.isEmpty() )
+            item->setToolTip( item->text() );
+        else
+            item->setToolTip( item->text() + QChar('\n') + s.d_person );
+        item->setData( Qt::UserRole, s.d_oid );
+        item->setIcon( QIcon( ":/images/at-sign-small.png") );
+        if( !MailMessage::isValidEmailAddress( s.d_addr.toLatin1() ) )
+            item->setBackground( Qt::red );
+        if( s.d_obsolete )
+            item->setFont( strikeOut );
     }
 }
 
 AddressSelectorPopup::AddressSelectorPopup(AddressIndexer *idx, QWidget * p):
-    QWidget( p, Qt::Popup ),d_idx(idx)
+    QWidget( p, Qt::Popup ),d_idx(idx),d_ticket(0)
 {
     Q_ASSERT( idx != 0 );
+    connect( idx, SIGNAL(sigFound(quint32,AddressIndexer::Suggestions,bool)),
+             this, SLOT(onFound(quint32,AddressIndexer::Suggestions,bool)) );
 
     setAttribute( Qt::WA_DeleteOnClose );
 
@@ -365,24 +562,26 @@ void AddressSelectorPopup::setText(const QString & str)
 void AddressSelectorPopup::fillList(const QString & str)
 {
     d_list->clear();
+    d_ticket = 0;
     if( str.size() < 2 )
         return;
-    QList<Udb::Obj> res = d_idx->find( str );
-    foreach( Udb::Obj o, res )
+    // Asynchron, damit kein Tastendruck verloren geht; die ersten Treffer kommen vor dem Rest
+    d_ticket = d_idx->findAsync( str, true, s_maxSuggestions );
+}
+
+void AddressSelectorPopup::onFound( quint32 ticket, const AddressIndexer::Suggestions& res, bool )
+{
+    if( ticket != d_ticket )
+        return;
+    foreach( const AddressIndexer::Suggestion& s, res )
     {
-        const bool isObsolete = o.getValue( AttrEmailObsolete ).getBool();
-        if( !isObsolete )
-        {
-            QListWidgetItem* item = new QListWidgetItem( d_list );
-            QString name = o.getString( AttrText );
-            QString addr = o.getString( AttrEmailAddress );
-            if( name.isEmpty() )
-                item->setText( addr );
-            else
-                item->setText( tr("%1 [%2]").arg(name).arg(addr) );
-            item->setData( Qt::UserRole, o.getOid() );
-            item->setIcon( QIcon( ":/images/at-sign-small.png") );
-        }
+        QListWidgetItem* item = new QListWidgetItem( d_list );
+        if( s.d_name.isEmpty() )
+            item->setText( s.d_addr );
+        else
+            item->setText( tr("%1 [%2]").arg(s.d_name).arg(s.d_addr) );
+        item->setData( Qt::UserRole, s.d_oid );
+        item->setIcon( QIcon( ":/images/at-sign-small.png") );
     }
 }
 
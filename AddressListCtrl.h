@@ -24,6 +24,7 @@
 #include <QTimer>
 #include <Udb/Obj.h>
 #include <GuiTools/AutoMenu.h>
+#include "AddressIndexer.h"
 
 class QLineEdit;
 class QListWidget;
@@ -32,8 +33,6 @@ class QLabel;
 
 namespace He
 {
-    class AddressIndexer;
-
     class AddressListCtrl : public QObject
     {
         Q_OBJECT
@@ -59,6 +58,7 @@ namespace He
     protected slots:
         void onEdited( const QString& );
         void onClicked(QListWidgetItem* item);
+        void onFound( quint32 ticket, const AddressIndexer::Suggestions&, bool done );
     protected:
         static void setName( QListWidgetItem*, const Udb::Obj& );
     private:
@@ -66,6 +66,7 @@ namespace He
         QListWidget* d_list;
         AddressIndexer* d_idx;
         QTimer d_doSearch;
+        quint32 d_ticket; // laufende Suche
         bool d_showObsolete;
     };
 
@@ -79,12 +80,14 @@ namespace He
         void sigSelected( const QString& name, const QString& addr );
     protected slots:
         void onAccept();
+        void onFound( quint32 ticket, const AddressIndexer::Suggestions&, bool done );
     protected:
         void fillList( const QString& );
         // overrides
         bool eventFilter(QObject *obj, QEvent *event);
     private:
         AddressIndexer* d_idx;
+        quint32 d_ticket; // laufende Suche
         QLabel* d_text;
         QListWidget* d_list;
     };
@@ -35,6 +35,8 @@
 #include <QInputDialog>
 #include <QDir>
 #include <QDialogButtonBox>
+#include <QTextBrowser>
+#include <QProgressDialog>
 #include <Oln2/OutlineUdbCtrl.h>
 #include <Udb/Database.h>
 #include <GuiTools/AutoShortcut.h>
@@ -62,6 +64,7 @@
 #include "RefViewCtrl.h"
 #include "ResendToDlg.h"
 #include "CalMainWindow.h"
+#include "StatsStore.h"
 using namespace He;
 
 class _MyDockWidget : public QDockWidget
@@ -115,6 +118,7 @@ EmailMainWindow::EmailMainWindow(Udb::Transaction * txn)
     connect( d_dmgr, SIGNAL(sigError(QString)), this, SLOT(onDownloadError(QString)) );
     connect( d_dmgr, SIGNAL(sigStatus(QString)), this, SLOT(onDownloadStatus(QString)) );
     d_aidx = new AddressIndexer( txn, this );
+    d_stats = new StatsStore( txn, this );
 
     d_umgr = new UploadManager( d_txn, this );
     connect( d_umgr, SIGNAL(sigError(QString)), this, SLOT(onUploadError(QString)) );
@@ -417,6 +421,12 @@ void EmailMainWindow::onImportMail()
     ImportManager mgr( d_txn );
     connect( &mgr,SIGNAL(sigError( const QString&)), this, SLOT(onImportError(QString)) );
     connect( &mgr,SIGNAL(sigStatus( const QString&)), this, SLOT(onImportStatus(QString)) );
+    QProgressDialog progress( tr("Importing mails..."), tr("Cancel"), 0, 0, this );
+    progress.setWindowTitle( tr("Import Mailbox - Herald") );
+    progress.setWindowModality( Qt::WindowModal );
+    connect( &mgr,SIGNAL(sigStatus( const QString&)), &progress, SLOT(setLabelText(QString)) );
+    connect( &progress, SIGNAL(canceled()), &mgr, SLOT(cancel()) );
+    progress.show();
     mgr.importEmlDir( path, res == 0 );
 
 }
@@ -639,6 +649,7 @@ void EmailMainWindow::addTopCommands(Gui::AutoMenu * pop)
 	pop->addCommand( tr("Go back"),  this, SLOT(onGoBack()), tr("ALT+LEFT") );
 	pop->addCommand( tr("Go forward"), this, SLOT(onGoForward()), tr("ALT+RIGHT") );
     pop->addCommand( tr("Search..."),  this, SLOT(onSearch()), tr("CTRL+F") );
+    pop->addCommand( tr("Message Statistics..."),  this, SLOT(onMessageStats()) );
     pop->addSeparator();
     QMenu* sub2 = createPopupMenu();
 	sub2->setTitle( tr("Show Window") );
@@ -785,6 +796,9 @@ void EmailMainWindow::setupSearchView()
     pop->addSeparator();
 	pop->addCommand( tr("Update Index..."), d_sv, SLOT(onUpdateIndex()) );
 	pop->addCommand( tr("Rebuild Index..."), d_sv, SLOT(onRebuildIndex()) );
+	pop->addCommand( tr("Optimize Index"), d_sv, SLOT(onOptimizeIndex()) );
+	pop->addCommand( tr("Index Statistics..."), d_sv, SLOT(onIndexStats()) );
+	pop->addCommand( tr("Index Benchmark..."), d_sv, SLOT(onIndexBenchmark()) );
     addTopCommands( pop );
 }
 
@@ -962,6 +976,75 @@ void EmailMainWindow::onShowCalendar()
         showCalendar();
 }
 
+static QString _statsTable( const QString& title, const QList<StatsStore::Count>& l, bool type = false )
+{
+    QString html = QString( "<h3>%1</h3><table cellspacing=0 cellpadding=2>" ).arg( title.toHtmlEscaped() );
+    for( int i = 0; i < l.size(); i++ )
+    {
+        QString key = l[i].d_key;
+        if( type )
+            key = HeTypeDefs::prettyName( key.toUInt() );
+        else if( key.isEmpty() )
+            key = EmailMainWindow::tr("(unknown)");
+        html += QString( "<tr><td>%1</td><td align=right>&nbsp;&nbsp;%2</td>"
+                         "<td align=right>&nbsp;&nbsp;%3 MB</td></tr>" ).
+                arg( key.toHtmlEscaped() ).arg( l[i].d_count ).
+                arg( l[i].d_size / 1024.0 / 1024.0, 0, 'f', 1 );
+    }
+    return html + QLatin1String( "</table>" );
+}
+
+void EmailMainWindow::onMessageStats()
+{
+    ENABLED_IF(true);
+
+    if( !d_stats->isOpen() )
+    {
+        if( QMessageBox::question( this, tr("Message Statistics - Herald"),
+                tr("The statistics are kept in a separate database next to the repository "
+                   "and updated with each change. Do you want to create it now?"),
+                QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes ) != QMessageBox::Yes )
+            return;
+        StatsStore::setEnabled( true );
+    }
+    bool rebuild = !d_stats->isComplete();
+    while( true )
+    {
+        if( rebuild )
+        {
+            QApplication::setOverrideCursor( Qt::WaitCursor );
+            const bool ok = d_stats->rebuild();
+            QApplication::restoreOverrideCursor();
+            if( !ok )
+            {
+                QMessageBox::critical( this, tr("Message Statistics - Herald"),
+                                       tr("Cannot build the statistics: %1").arg( d_stats->getError() ) );
+                return;
+            }
+        }
+        QDialog dlg( this );
+        dlg.setWindowTitle( tr("Message Statistics - Herald") );
+        QVBoxLayout* vbox = new QVBoxLayout( &dlg );
+        QTextBrowser* text = new QTextBrowser( &dlg );
+        text->setHtml( tr("<p>%1 messages in %2</p>").arg( d_stats->getMessageCount() ).
+                       arg( d_stats->getStorePath().toHtmlEscaped() ) +
+                       _statsTable( tr("By Type"), d_stats->countBy( StatsStore::ByType ), true ) +
+                       _statsTable( tr("By Year"), d_stats->countBy( StatsStore::ByYear ) ) +
+                       _statsTable( tr("By Month"), d_stats->countBy( StatsStore::ByMonth, 24 ) ) +
+                       _statsTable( tr("Top Senders"), d_stats->countBy( StatsStore::BySender, 50 ) ) );
+        vbox->addWidget( text );
+        QDialogButtonBox* bb = new QDialogButtonBox( QDialogButtonBox::Close, Qt::Horizontal, &dlg );
+        bb->addButton( tr("Rebuild"), QDialogButtonBox::AcceptRole );
+        vbox->addWidget( bb );
+        connect( bb, SIGNAL(accepted()), &dlg, SLOT(accept()) );
+        connect( bb, SIGNAL(rejected()), &dlg, SLOT(reject()) );
+        dlg.resize( 480, 600 );
+        if( dlg.exec() != QDialog::Accepted )
+            return;
+        rebuild = true;
+    }
+}
+
 void EmailMainWindow::onSearch()
 {
     ENABLED_IF( true );
@@ -47,6 +47,7 @@ namespace He
     class SearchView;
     class RefViewCtrl;
     class CalMainWindow;
+    class StatsStore;
 
     class EmailMainWindow : public QMainWindow
     {
@@ -100,6 +101,7 @@ namespace He
 		void onSendFromFile();
 		void onSendCert1();
         void onShowCalendar();
+        void onMessageStats();
 	protected:
         void setCaption();
         void setupInbox();
@@ -134,6 +136,7 @@ namespace He
         TextViewCtrl* d_textView;
         RefViewCtrl* d_refView;
         SearchView* d_sv;
+        StatsStore* d_stats;
         QList<MailEdit*> d_editors;
         QList<Udb::OID> d_backHisto; // d_backHisto.last() ist aktuell angezeigtes Objekt
 		QList<Udb::OID> d_forwardHisto;
@@ -20,14 +20,22 @@
 #include "FullTextIndexer.h"
 #include "HeTypeDefs.h"
 #include "HeraldApp.h"
+#include "MailObj.h"
 #include <Udb/Transaction.h>
 #include <Udb/Database.h>
 #include <Udb/Extent.h>
+#include <Udb/Idx.h>
+#include <Mail/MailMessage.h>
 #include <QProgressDialog>
 #include <QtDebug>
 #include <QApplication>
 #include <QProgressDialog>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QTextCodec>
+#include <QEvent>
+#include <QTextStream>
+#ifdef _HAS_CLUCENE_
 #include <QLucene/qindexwriter_p.h>
 #include <QLucene/qanalyzer_p.h>
 #include <QLucene/qindexreader_p.h>
@@ -35,6 +43,8 @@
 #include <QLucene/qsearchable_p.h>
 #include <QLucene/qhits_p.h>
 #include <QLucene/qqueryparser_p.h>
+#include <QLucene/qsort_p.h>
+#endif
 using namespace He;
 
 // Aus Crossline, gekürzt
@@ -42,6 +52,7 @@ using namespace He;
 typedef QVector< QPair<quint64,quint16> > ObjList;
 typedef QHash<QString,ObjList> Dict;
 
+#ifdef _HAS_CLUCENE_
 // RISK
   class CLuceneError
   {
@@ -51,6 +62,15 @@ typedef QHash<QString,ObjList> Dict;
 	TCHAR* _twhat;
   };
 
+// QCLuceneSort( field ) nimmt SortField::AUTO; CLucene hielte rein numerische Werte (yyyyMMddhhmm)
+// für INT, was überläuft. Darum steht vor "senttime" ein Buchstabe, womit AUTO STRING wählt.
+static const QLatin1Char s_sentPrefix( 't' );
+#endif
+
+// Erhöhen, wenn sich Felder oder deren Kodierung ändern; ein Index mit anderem Schema gilt als
+// nicht vorhanden und wird neu erstellt.
+static const quint32 s_indexSchema = 3; // 2: "senttime" für alle Dokumente, 3: mit s_sentPrefix
+
 static bool toIndex( quint32 t )
 {
 	return true;
@@ -74,12 +94,94 @@ QString FullTextIndexer::fetchText( const Udb::Obj& obj, quint32 atom )
 	return v.toString(true);
 }
 
-static int _findText( const QString& pattern, const QString& text )
+static const int s_maxMatcherCache = 50000; // Einträge, danach wird der Cache geleert
+
+static QList<TextMatcher*>& _matchers()
+{
+	// Lokal statisch, damit die Liste erst nach dem letzten statischen TextMatcher abgebaut wird
+	static QList<TextMatcher*> s_matchers;
+	return s_matchers;
+}
+
+TextMatcher::TextMatcher( const QString& pattern )
+{
+	for( int i = 0; i < 256; i++ )
+		d_skip[i] = 0;
+	setPattern( pattern );
+	_matchers().append( this );
+}
+
+TextMatcher::~TextMatcher()
+{
+	_matchers().removeAll( this );
+}
+
+void TextMatcher::invalidate( Udb::OID oid, quint32 atom )
+{
+	const Key key( oid, atom );
+	foreach( TextMatcher* m, _matchers() )
+		m->d_cache.remove( key );
+}
+
+QString TextMatcher::fold( const QString& text )
+{
+	return text.simplified().toCaseFolded();
+}
+
+void TextMatcher::setPattern( const QString& pattern )
+{
+	if( !d_raw.isNull() && pattern == d_raw )
+		return;
+	d_raw = pattern;
+	d_pattern = pattern.toCaseFolded(); // nicht simplified, wie bisher
+	// Horspool; Zeichen werden über das untere Byte auf 256 Einträge abgebildet. Bei Kollision
+	// gewinnt der kleinere Sprung, die Suche bleibt also korrekt.
+	const int m = d_pattern.size();
+	for( int i = 0; i < 256; i++ )
+		d_skip[i] = m;
+	for( int i = 0; i < m - 1; i++ )
+		d_skip[ d_pattern[i].unicode() & 0xff ] = m - 1 - i;
+}
+
+int TextMatcher::indexIn( const QString& text ) const
+{
+	const int m = d_pattern.size();
+	const int n = text.size();
+	if( m == 0 )
+		return 0;
+	const QChar* t = text.constData();
+	const QChar* p = d_pattern.constData();
+	int i = 0;
+	while( i <= n - m )
+	{
+		int j = m - 1;
+		while( j >= 0 && t[i + j] == p[j] )
+			j--;
+		if( j < 0 )
+			return i;
+		i += d_skip[ t[i + m - 1].unicode() & 0xff ];
+	}
+	return -1;
+}
+
+bool TextMatcher::matches( const Udb::Obj& obj, quint32 atom )
 {
-    QRegExp expr(pattern);
-    expr.setPatternSyntax(QRegExp::FixedString);
-    expr.setCaseSensitivity(Qt::CaseInsensitive);
-    return expr.indexIn(text.simplified());
+	if( obj.isNull() )
+		return d_pattern.isEmpty();
+	// Wie fetchText; gecacht wird beim Objekt, das den Text hält, da dessen Änderungen gemeldet werden.
+	// Der Text wird nur bei einem Cache-Miss gelesen.
+	Udb::Obj src = obj.getValueAsObj( AttrItemLink );
+	if( src.isNull() )
+		src = obj;
+	const Key key( src.getOid(), atom );
+	QHash<Key,QString>::const_iterator i = d_cache.constFind( key );
+	if( i == d_cache.constEnd() )
+	{
+		if( d_cache.size() >= s_maxMatcherCache )
+			d_cache.clear();
+		i = d_cache.insert( key, fold( src.getValue( atom ).toString( true ) ) );
+	}
+	return indexIn( i.value() ) != -1; // leerer Text passt nur auf ein leeres Pattern
 }
 
 Udb::Obj FullTextIndexer::gotoNext( const Udb::Obj& obj )
@@ -139,6 +241,14 @@ Udb::Obj FullTextIndexer::gotoPrev( const Udb::Obj& obj )
 }
 
 Udb::Obj FullTextIndexer::findText( const QString& pattern, const Udb::Obj& cur, bool forward )
+{
+	// Bleibt über Aufrufe erhalten, damit F3 weder neu kompiliert noch neu faltet; nur GUI-Thread
+	static TextMatcher s_matcher;
+	s_matcher.setPattern( pattern );
+	return findText( s_matcher, cur, forward );
+}
+
+Udb::Obj FullTextIndexer::findText( TextMatcher& matcher, const Udb::Obj& cur, bool forward )
 {
 	if( cur.isNull() )
 		return Udb::Obj();
@@ -146,9 +256,7 @@ Udb::Obj FullTextIndexer::findText( const QString& pattern, const Udb::Obj& cur,
 	while( !obj.isNull() )
 	{
 		//qDebug( "checking %d", obj.getValue( AttrObjRelId ).getInt32() );
-		const QString text = fetchText( obj, AttrText );
-		const int hit = _findText( pattern, text );
-		if( hit != -1 )
+		if( matcher.matches( obj, AttrText ) )
 		{
 			//qDebug( "hit!" );
 			return obj;
@@ -162,13 +270,59 @@ Udb::Obj FullTextIndexer::findText( const QString& pattern, const Udb::Obj& cur,
 }
 
 const char* FullTextIndexer::s_pendingUuid = "{2D826784-B089-4e98-BBB0-F5E4F2F1AD78}";
+const char* FullTextIndexer::s_rebuildUuid = "{6A1B5E0C-3F47-4d2b-9C1E-8B7F2A4D5C93}";
 
-FullTextIndexer::FullTextIndexer( Udb::Transaction * txn, QObject * p ):QObject(p)
+static const int s_kickDelay = 1500; // ms nach dem letzten Commit
+static const int s_maxBatch = 500; // Objekte pro Durchgang des Workers
+static const int s_maxCacheCost = 2000000; // Summe der gecachten Hit-IDs über alle Queries
+static const int s_hitPage = 256; // Hit-IDs, die fetchHit auf einmal von Lucene holt
+static const int s_minMergeDocs = 1000; // Writer-Parameter, für alle Writer gleich
+static const int s_maxBufferedDocs = 100;
+static const int s_maintInterval = 5 * 60 * 1000; // ms; so oft wird geprüft, ob optimiert werden soll
+static const int s_idleTime = 3 * 60 * 1000; // ms ohne Benutzereingabe, bis die Anwendung als idle gilt
+static const int s_maxSegments = 10; // mehr Segmente lösen Optimize aus
+static const double s_maxDeletedRatio = 0.1; // Anteil gelöschter Dokumente, der Optimize auslöst
+static const Udb::OID s_minChunk = 20000; // OIDs pro Checkpoint beim Rebuild
+static const int s_readBatch = 64; // Objekte pro Database::Lock beim Rebuild
+
+FullTextIndexer::FullTextIndexer( Udb::Transaction * txn, QObject * p ):QObject(p),
+	d_native(0),d_reader(0),d_searcher(0),d_searcherGen(0),d_generation(1),d_writesSaved(0),
+	d_cacheHits(0),d_cacheNarrowed(0)
 {
+	d_cache.setMaxCost( s_maxCacheCost );
 	QUuid uuid = s_pendingUuid;
     d_pending = txn->getOrCreateObject( uuid );
+	d_rebuild = txn->getOrCreateObject( QUuid( s_rebuildUuid ) );
 	txn->commit();
 	txn->addObserver( this, SLOT(onDbUpdate( Udb::UpdateInfo ) ), false );
+#ifndef _HAS_CLUCENE_
+	d_native = new NativeIndex( txn );
+#endif
+
+	d_worker = new FullTextWorker( txn->getDb(), getIndexPath(), this );
+	connect( d_worker, SIGNAL(sigBatchDone()), this, SLOT(onBatchDone()), Qt::QueuedConnection );
+
+	d_kick.setSingleShot( true );
+	d_kick.setInterval( s_kickDelay );
+	connect( &d_kick, SIGNAL(timeout()), this, SLOT(onKick()) );
+
+	loadJournal();
+	if( !d_journal.isEmpty() )
+		d_kick.start();
+
+	d_lastInput.start();
+	QCoreApplication::instance()->installEventFilter( this ); // nur für die Idle-Erkennung
+	d_maint.setInterval( s_maintInterval );
+	connect( &d_maint, SIGNAL(timeout()), this, SLOT(onMaintenance()) );
+	d_maint.start();
+}
+
+FullTextIndexer::~FullTextIndexer()
+{
+	d_worker->stop();
+	d_worker->wait();
+	releaseSearcher();
+	delete d_native;
 }
 
 QString FullTextIndexer::getIndexPath() const
@@ -181,56 +335,519 @@ QString FullTextIndexer::getIndexPath() const
 
 bool FullTextIndexer::exists()
 {
-	return QCLuceneIndexReader::indexExists( getIndexPath() );
+#ifdef _HAS_CLUCENE_
+	// Ältere Indizes haben z.B. kein "senttime", womit jede Sortierung nach Datum scheitert
+	return QCLuceneIndexReader::indexExists( getIndexPath() ) &&
+			d_rebuild.getValue( d_rebuild.getAtom( "IndexSchema" ) ).getUInt32() == s_indexSchema;
+#else
+	return d_native->exists();
+#endif
 }
 
-static void indexItem( const Udb::Obj& item, QCLuceneIndexWriter& w, QCLuceneAnalyzer& a )
+const char* FullTextIndexer::engineName()
 {
-	QCLuceneDocument ld;
+#ifdef _HAS_CLUCENE_
+	return "Lucene";
+#else
+	return "Native";
+#endif
+}
+
+struct _ItemText
+{
+	Udb::OID d_oid;
+	QString d_title;
+	QString d_body;
+	QString d_id;
+	QString d_type; // untokenized, z.B. "inbound"
+	QString d_sent; // untokenized, yyyyMMddhhmm lokale Zeit
+	QString d_from; // untokenized, Absenderadresse in Kleinbuchstaben
+	QString d_file; // nur TypeDocument; wird erst ausserhalb des DB-Locks gelesen
+	bool d_html; // d_body ist HTML; wird erst ausserhalb des DB-Locks konvertiert
+	_ItemText():d_oid(0),d_html(false){}
+	bool isEmpty() const { return d_title.isEmpty() && d_body.isEmpty() && d_id.isEmpty(); }
+};
+
+QString FullTextIndexer::typeName( quint32 type )
+{
+	// Werte des Feldes "type"; nicht übersetzen, da Teil der Query-Syntax
+	switch( type )
+	{
+	case TypeInboundMessage:
+		return QLatin1String("inbound");
+	case TypeOutboundMessage:
+		return QLatin1String("outbound");
+	case TypeMailDraft:
+		return QLatin1String("draft");
+	case TypeAttachment:
+		return QLatin1String("attachment");
+	case TypeDocument:
+		return QLatin1String("document");
+	case TypeFromParty:
+	case TypeToParty:
+	case TypeCcParty:
+	case TypeBccParty:
+	case TypeResentParty:
+		return QLatin1String("party");
+	case TypeEmailAddress:
+		return QLatin1String("address");
+	case TypePerson:
+		return QLatin1String("person");
+	case TypeOutline:
+		return QLatin1String("outline");
+	case TypeOutlineItem:
+		return QLatin1String("item");
+	case TypeAppointment:
+		return QLatin1String("appointment");
+	case TypeDeadline:
+		return QLatin1String("deadline");
+	case TypeEvent:
+		return QLatin1String("event");
+	case TypeSchedule:
+		return QLatin1String("schedule");
+	default:
+		return QLatin1String("other");
+	}
+}
+
+Udb::Obj FullTextIndexer::resolveHit( const Udb::Obj& o )
+{
+	if( o.isNull() || o.getType() != TypeDocument )
+		return o;
+	// Ein Dokument existiert pro Hash nur einmal; angezeigt wird das Attachment der neusten Mail
+	const QList<Udb::Obj> refs = findReferences( o );
+	if( refs.isEmpty() )
+		return o;
+	else
+		return refs.first();
+}
+
+static bool _laterMail( const QPair<QDateTime,Udb::Obj>& lhs, const QPair<QDateTime,Udb::Obj>& rhs )
+{
+	return lhs.first > rhs.first;
+}
+
+QList<Udb::Obj> FullTextIndexer::findReferences( const Udb::Obj& doc )
+{
+	QList< QPair<QDateTime,Udb::Obj> > atts;
+	Udb::Idx refs( doc.getTxn(), IndexDefs::IdxDocumentRef );
+	if( refs.seek( doc ) ) do
+	{
+		Udb::Obj att = doc.getObject( refs.getOid() );
+		if( !att.isNull() )
+			atts.append( qMakePair( att.getParent().getValue( AttrSentOn ).getDateTime(), att ) );
+	}while( refs.nextKey() );
+	qStableSort( atts.begin(), atts.end(), _laterMail );
+	QList<Udb::Obj> res;
+	for( int i = 0; i < atts.size(); i++ )
+		res.append( atts[i].second );
+	return res;
+}
+
+int FullTextIndexer::countReferences( const Udb::Obj& doc )
+{
+	int res = 0;
+	Udb::Idx refs( doc.getTxn(), IndexDefs::IdxDocumentRef );
+	if( refs.seek( doc ) ) do
+	{
+		res++;
+	}while( refs.nextKey() );
+	return res;
+}
+
+static _ItemText fetchItem( const Udb::Obj& item )
+{
+	_ItemText t;
+	t.d_oid = item.getOid();
+	t.d_title = FullTextIndexer::fetchText( item, AttrText );
+	Udb::Obj link = item.getValueAsObj( AttrItemLink );
+	const Stream::DataCell body = ( link.isNull() ) ? item.getValue( AttrBody ) : link.getValue( AttrBody );
+	t.d_html = body.isHtml();
+	t.d_body = ( t.d_html ) ? body.getStr() : body.toString( true );
+	t.d_id = item.getString( AttrInternalId );
+	t.d_type = FullTextIndexer::typeName( item.getType() );
+	Udb::Obj src = item;
+	if( item.getType() == TypeDocument )
+	{
+		t.d_file = AttachmentObj::getFilePath( item );
+		// Ein Dokument hat selber kein Datum; es gilt jenes der neusten Mail, an der es hängt
+		src = FullTextIndexer::resolveHit( item );
+	}
+	// Attachments und Parties erben Datum und Absender der Mail, wie in der Anzeige der SearchView
+	MailObj mail;
+	if( HeTypeDefs::isEmail( src.getType() ) )
+		mail = src;
+	else if( !src.getParent().isNull() && HeTypeDefs::isEmail( src.getParent().getType() ) )
+		mail = src.getParent();
+	Stream::DataCell v = src.getValue( AttrSentOn );
+	if( !v.isDateTime() && !src.getParent().isNull() )
+		v = src.getParent().getValue( AttrSentOn );
+	if( v.isDateTime() )
+		t.d_sent = v.getDateTime().toLocalTime().toString( "yyyyMMddhhmm" );
+	if( !mail.isNull() )
+		t.d_from = QString::fromLatin1( mail.getFrom( false ).d_addr ).toLower();
+	return t;
+}
+
+static const qint64 s_maxFileSize = 8 * 1024 * 1024; // grössere Dateien werden nicht gelesen
+
+static QString decodeText( const QByteArray& data )
+{
+	// BOM gewinnt; sonst UTF-8 falls gültig, ansonsten Latin-1
+	QTextCodec* codec = QTextCodec::codecForUtfText( data, 0 );
+	if( codec != 0 )
+		return codec->toUnicode( data );
+	QTextCodec::ConverterState state;
+	const QString res = QTextCodec::codecForName( "UTF-8" )->toUnicode( data.constData(), data.size(), &state );
+	if( state.invalidChars == 0 )
+		return res;
+	return QString::fromLatin1( data );
+}
+
+static bool _tagIs( const QChar* name, int len, const char* tag )
+{
+	// tag ist lower case ascii
+	int i = 0;
+	for( ; i < len && tag[i] != 0; i++ )
+	{
+		if( name[i].toLower().unicode() != ushort(tag[i]) )
+			return false;
+	}
+	return i == len && tag[i] == 0;
+}
+
+static bool _isBlockTag( const QChar* name, int len )
+{
+	// Tags, die Wörter trennen; inline Tags wie b oder span dürfen das nicht
+	static const char* s_block[] = { "p", "br", "div", "tr", "td", "th", "li", "ul", "ol", "table",
+		"h1", "h2", "h3", "h4", "h5", "h6", "hr", "blockquote", "pre", "title", "option", "dt", "dd",
+		"section", "article", "header", "footer", "body", "address", 0 };
+	for( int i = 0; s_block[i] != 0; i++ )
+		if( _tagIs( name, len, s_block[i] ) )
+			return true;
+	return false;
+}
+
+static const QChar* _skipPast( const QChar* p, const QChar* end, const char* str, bool ci )
+{
+	// Gibt den Zeiger nach dem ersten Vorkommen von str zurück, bzw. end
+	const int len = qstrlen( str );
+	for( ; end - p >= len; p++ )
+	{
+		int i = 0;
+		while( i < len && ( ci ? p[i].toLower().unicode() : p[i].unicode() ) == ushort(str[i]) )
+			i++;
+		if( i == len )
+			return p + len;
+	}
+	return end;
+}
+
+static QHash<QString,ushort> _entityTable()
+{
+	static const struct { const char* n; ushort c; } s_tab[] = {
+		{"nbsp",0x20},{"amp",'&'},{"lt",'<'},{"gt",'>'},{"quot",'"'},{"apos",'\''},
+		{"auml",0xe4},{"ouml",0xf6},{"uuml",0xfc},{"Auml",0xc4},{"Ouml",0xd6},{"Uuml",0xdc},
+		{"szlig",0xdf},{"eacute",0xe9},{"egrave",0xe8},{"ecirc",0xea},{"agrave",0xe0},
+		{"aacute",0xe1},{"acirc",0xe2},{"ccedil",0xe7},{"iacute",0xed},{"oacute",0xf3},
+		{"uacute",0xfa},{"ntilde",0xf1},{"Eacute",0xc9},{"euro",0x20ac},{"copy",0xa9},
+		{"reg",0xae},{"trade",0x2122},{"hellip",0x2026},{"ndash",0x2013},{"mdash",0x2014},
+		{"laquo",0xab},{"raquo",0xbb},{"lsquo",0x2018},{"rsquo",0x2019},{"ldquo",0x201c},
+		{"rdquo",0x201d},{"bdquo",0x201e},{"sbquo",0x201a},{"middot",0xb7},{"bull",0x2022},
+		{"deg",0xb0},{"sect",0xa7},{"para",0xb6},{"shy",0x20},{"zwnj",0x20},{"thinsp",0x20},
+		{"ensp",0x20},{"emsp",0x20},{0,0} };
+	QHash<QString,ushort> res;
+	for( int i = 0; s_tab[i].n != 0; i++ )
+		res.insert( QLatin1String( s_tab[i].n ), s_tab[i].c );
+	return res;
+}
+
+static uint _decodeEntity( const QChar* p, const QChar* end, const QChar*& after )
+{
+	// p zeigt nach '&'; gibt 0 zurück, wenn keine gültige Entity. Leerzeichen-Entities geben 0x20.
+	static const QHash<QString,ushort> s_names = _entityTable(); // Worker und Rebuild-Threads
+	const QChar* q = p;
+	if( q < end && *q == QLatin1Char('#') )
+	{
+		q++;
+		int base = 10;
+		if( q < end && ( *q == QLatin1Char('x') || *q == QLatin1Char('X') ) )
+		{
+			base = 16;
+			q++;
+		}
+		uint code = 0;
+		int digits = 0;
+		for( ; q < end && digits < 8; q++, digits++ )
+		{
+			const ushort u = q->unicode();
+			int d = -1;
+			if( u >= '0' && u <= '9' )
+				d = u - '0';
+			else if( base == 16 && u >= 'a' && u <= 'f' )
+				d = u - 'a' + 10;
+			else if( base == 16 && u >= 'A' && u <= 'F' )
+				d = u - 'A' + 10;
+			if( d < 0 )
+				break;
+			code = code * base + d;
+		}
+		if( digits == 0 || code == 0 || code > 0x10ffff )
+			return 0;
+		if( q < end && *q == QLatin1Char(';') )
+			q++;
+		after = q;
+		return code;
+	}
+	while( q < end && q - p < 10 && q->isLetterOrNumber() )
+		q++;
+	if( q == p || q >= end || *q != QLatin1Char(';') )
+		return 0;
+	const ushort c = s_names.value( QString( p, q - p ), 0 );
+	if( c == 0 )
+		return 0;
+	after = q + 1;
+	return c;
+}
+
+QString FullTextIndexer::htmlToText( const QString& html )
+{
+	// Ein Durchgang ohne DOM und ohne RegExp. Inhalte von style und script sowie Kommentare werden
+	// übersprungen, Entities dekodiert und Whitespace zusammengefasst.
+	QString res;
+	res.reserve( html.size() / 2 );
+	const QChar* p = html.constData();
+	const QChar* const end = p + html.size();
+	bool space = true; // kein führendes Leerzeichen
+	while( p < end )
+	{
+		const ushort c = p->unicode();
+		if( c == '<' )
+		{
+			if( end - p >= 4 && p[1] == QLatin1Char('!') && p[2] == QLatin1Char('-') && p[3] == QLatin1Char('-') )
+			{
+				p = _skipPast( p + 4, end, "-->", false );
+				continue;
+			}
+			const QChar* q = p + 1;
+			const bool closing = q < end && *q == QLatin1Char('/');
+			if( closing )
+				q++;
+			const QChar* name = q;
+			const bool decl = q < end && ( *q == QLatin1Char('!') || *q == QLatin1Char('?') );
+			while( q < end && q->isLetterOrNumber() )
+				q++;
+			const int nameLen = q - name;
+			if( nameLen == 0 && !decl )
+			{
+				// kein Tag, z.B. "a < b"
+				res += *p++;
+				space = false;
+				continue;
+			}
+			// Ende des Tags; Attributwerte in Anführungszeichen dürfen '>' enthalten
+			ushort quote = 0;
+			while( q < end && ( quote != 0 || *q != QLatin1Char('>') ) )
+			{
+				if( quote != 0 )
+				{
+					if( q->unicode() == quote )
+						quote = 0;
+				}else if( *q == QLatin1Char('"') || *q == QLatin1Char('\'') )
+					quote = q->unicode();
+				q++;
+			}
+			if( q < end )
+				q++;
+			if( !closing && !decl )
+			{
+				if( _tagIs( name, nameLen, "style" ) )
+					q = _skipPast( _skipPast( q, end, "</style", true ), end, ">", false );
+				else if( _tagIs( name, nameLen, "script" ) )
+					q = _skipPast( _skipPast( q, end, "</script", true ), end, ">", false );
+			}
+			if( _isBlockTag( name, nameLen ) && !space )
+			{
+				res += QLatin1Char(' ');
+				space = true;
+			}
+			p = q;
+		}else if( c == '&' )
+		{
+			const QChar* after = 0;
+			const uint code = _decodeEntity( p + 1, end, after );
+			if( code == 0 )
+			{
+				res += *p++;
+				space = false;
+			}else
+			{
+				if( code == 0x20 )
+				{
+					if( !space )
+						res += QLatin1Char(' ');
+					space = true;
+				}else
+				{
+					if( QChar::requiresSurrogates( code ) )
+					{
+						res += QChar( QChar::highSurrogate( code ) );
+						res += QChar( QChar::lowSurrogate( code ) );
+					}else
+						res += QChar( ushort( code ) );
+					space = false;
+				}
+				p = after;
+			}
+		}else if( p->isSpace() )
+		{
+			if( !space )
+				res += QLatin1Char(' ');
+			space = true;
+			p++;
+		}else
+		{
+			res += *p++;
+			space = false;
+		}
+	}
+	if( res.endsWith( QLatin1Char(' ') ) )
+		res.chop( 1 );
+	res.squeeze();
+	return res;
+}
+
+static QString extractFileText( const QString& path )
+{
+	// Läuft ohne DB-Lock; nur Formate, die ohne externe Konverter lesbar sind
+	QFileInfo info( path );
+	if( !info.isFile() || info.size() > s_maxFileSize )
+		return QString();
+	const QString suffix = info.suffix().toLower();
+	if( suffix == QLatin1String("eml") )
+	{
+		MailMessage msg;
+		msg.fromRFC822( LongString( path, false ) );
+		QString res = msg.subject() + QLatin1Char('\n') + msg.fromName() + QLatin1Char(' ') +
+				QString::fromLatin1( msg.fromEmail() ) + QLatin1Char('\n');
+		if( !msg.htmlBody().isEmpty() )
+			res += FullTextIndexer::htmlToText( msg.htmlBody() );
+		else
+			res += msg.plainTextBody();
+		return res;
+	}
+	const bool html = suffix == QLatin1String("htm") || suffix == QLatin1String("html");
+	if( !html && suffix != QLatin1String("txt") && suffix != QLatin1String("text") &&
+			suffix != QLatin1String("csv") && suffix != QLatin1String("ics") &&
+			suffix != QLatin1String("vcf") && suffix != QLatin1String("log") )
+		return QString();
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return QString();
+	const QString text = decodeText( f.readAll() );
+	if( html )
+		return FullTextIndexer::htmlToText( text );
+	else
+		return text;
+}
+
+#ifdef _HAS_CLUCENE_
+// Gibt die Anzahl indizierter Zeichen zurück, in raw jene vor der HTML-Extraktion
+static int indexItem( const _ItemText& item, QCLuceneIndexWriter& w, QCLuceneAnalyzer& a, int* raw = 0 )
+{
+	if( raw )
+		*raw = 0;
+	if( item.isEmpty() )
+		return 0;
 
-	const QString title = FullTextIndexer::fetchText( item, AttrText );
-    const QString body = FullTextIndexer::fetchText( item, AttrBody );
-    const QString id = item.getString( AttrInternalId );
+	QCLuceneDocument ld;
 
-    int count = 0;
 	ld.add(new QCLuceneField(QLatin1String("oid"),
-		QString::number( item.getOid(), 16 ), QCLuceneField::STORE_YES |
+		QString::number( item.d_oid, 16 ), QCLuceneField::STORE_YES |
         QCLuceneField::INDEX_UNTOKENIZED ) );
+	ld.add(new QCLuceneField(QLatin1String("type"), item.d_type, QCLuceneField::STORE_YES |
+		QCLuceneField::INDEX_UNTOKENIZED ) );
+	// "sent" nur mit Tagesauflösung, damit Range-Queries wie sent:[20240101 TO 20241231] den
+	// letzten Tag einschliessen; "senttime" dient der Sortierung und Anzeige. Leer sortiert zuletzt.
+	if( !item.d_sent.isEmpty() )
+		ld.add(new QCLuceneField(QLatin1String("sent"), item.d_sent.left( 8 ),
+			QCLuceneField::INDEX_UNTOKENIZED ) );
+	ld.add(new QCLuceneField(QLatin1String("senttime"),
+		QString( s_sentPrefix ) + ( ( item.d_sent.isEmpty() ) ? QString( QLatin1Char('0') ) : item.d_sent ),
+		QCLuceneField::STORE_YES | QCLuceneField::INDEX_UNTOKENIZED ) );
+	if( !item.d_from.isEmpty() )
+		ld.add(new QCLuceneField(QLatin1String("from"), item.d_from, QCLuceneField::STORE_YES |
+			QCLuceneField::INDEX_UNTOKENIZED ) );
 
-    if( !title.isEmpty() )
+    if( !item.d_title.isEmpty() )
     {
-        ld.add(new QCLuceneField(QLatin1String("subject"), title, QCLuceneField::INDEX_TOKENIZED) );
-        ld.add(new QCLuceneField(QLatin1String("content"), title, QCLuceneField::INDEX_TOKENIZED) );
-        count++;
+        ld.add(new QCLuceneField(QLatin1String("subject"), item.d_title, QCLuceneField::INDEX_TOKENIZED) );
+        ld.add(new QCLuceneField(QLatin1String("content"), item.d_title, QCLuceneField::INDEX_TOKENIZED) );
     }
+	// Tags, CSS und Entities würden sonst als Tokens im Index landen
+	const QString body = ( item.d_html ) ? FullTextIndexer::htmlToText( item.d_body ) : item.d_body;
     if( !body.isEmpty() )
     {
         ld.add(new QCLuceneField(QLatin1String("body"), body, QCLuceneField::INDEX_TOKENIZED) );
         ld.add(new QCLuceneField(QLatin1String("content"), body, QCLuceneField::INDEX_TOKENIZED) );
-        count++;
     }
-	if( !id.isEmpty() )
+	if( !item.d_id.isEmpty() )
 	{
-		ld.add(new QCLuceneField(QLatin1String("ident"), id, QCLuceneField::INDEX_TOKENIZED) );
-		ld.add(new QCLuceneField(QLatin1String("content"), id, QCLuceneField::INDEX_TOKENIZED) );
-        count++;
+		ld.add(new QCLuceneField(QLatin1String("ident"), item.d_id, QCLuceneField::INDEX_TOKENIZED) );
+		ld.add(new QCLuceneField(QLatin1String("content"), item.d_id, QCLuceneField::INDEX_TOKENIZED) );
+	}
+	int len = item.d_title.size() + body.size() + item.d_id.size();
+	if( raw )
+		*raw = item.d_title.size() + item.d_body.size() + item.d_id.size();
+	if( !item.d_file.isEmpty() )
+	{
+		// Dokumente sind per Hash dedupliziert; der Inhalt wird also nur einmal tokenisiert, auch
+		// wenn dieselbe Datei an vielen Mails hängt.
+		const QString text = extractFileText( item.d_file );
+		if( !text.isEmpty() )
+		{
+			ld.add(new QCLuceneField(QLatin1String("attachment"), text, QCLuceneField::INDEX_TOKENIZED) );
+			ld.add(new QCLuceneField(QLatin1String("content"), text, QCLuceneField::INDEX_TOKENIZED) );
+			len += text.size();
+			if( raw )
+				*raw += text.size();
+		}
 	}
-    if( count )
-        w.addDocument( ld, a );
+    w.addDocument( ld, a );
+	return len;
 }
-
-static int calcCount2( const Udb::Obj& o )
+#else
+// Dieselben Felder wie mit Lucene; "content" ist die Vereinigung der Felder
+static int indexItem( const _ItemText& item, NativeIndex::Doc& doc, int* raw = 0 )
 {
-	int res = 0;
-    Udb::Mit i = o.findCells( Udb::Obj::KeyList() );
-    if( !i.isNull() ) do
+	if( raw )
+		*raw = 0;
+	doc = NativeIndex::Doc();
+	if( item.isEmpty() )
+		return 0;
+	doc.d_oid = item.d_oid;
+	doc.d_sent = item.d_sent;
+	doc.addKey( "type", item.d_type );
+	doc.addKey( "sent", item.d_sent.left( 8 ) );
+	doc.addKey( "from", item.d_from );
+	doc.addText( item.d_title, NativeIndex::Subject );
+	const QString body = ( item.d_html ) ? FullTextIndexer::htmlToText( item.d_body ) : item.d_body;
+	doc.addText( body, NativeIndex::Body );
+	doc.addText( item.d_id, NativeIndex::Ident );
+	int len = item.d_title.size() + body.size() + item.d_id.size();
+	if( raw )
+		*raw = item.d_title.size() + item.d_body.size() + item.d_id.size();
+	if( !item.d_file.isEmpty() )
 	{
-		Udb::Mit::KeyList k = i.getKey();
-		if( !k.isEmpty() && k[0].isOid() )
-			res++;
-	}while( i.nextKey() );
-	return res;
+		const QString text = extractFileText( item.d_file );
+		doc.addText( text, NativeIndex::Attachment );
+		len += text.size();
+		if( raw )
+			*raw += text.size();
+	}
+	return len;
 }
+#endif
 
 static void _print( const Udb::Mit::KeyList& k )
 {
@@ -242,103 +859,183 @@ static void _print( const Udb::Mit::KeyList& k )
 
 bool FullTextIndexer::hasPendingUpdates() const
 {
-	Udb::Mit i = d_pending.findCells( Udb::Obj::KeyList() );
-	Udb::Mit::KeyList k = i.getKey();
-	return !k.isEmpty() && k[0].isOid();
+	return !d_journal.isEmpty();
+}
+
+void FullTextIndexer::loadJournal()
+{
+	// Einmal beim Start; danach wird d_journal parallel zum persistenten Journal nachgeführt,
+	// sodass weder onDbUpdate noch onKick das Journal lesen müssen.
+	d_journal.clear();
+	QList<Udb::Mit::KeyList> toRemove;
+	Udb::Mit mit = d_pending.findCells( Udb::Obj::KeyList() );
+	if( !mit.isNull() ) do
+	{
+		Udb::Mit::KeyList k = mit.getKey();
+		if( k.size() == 1 && k[0].isOid() )
+			d_journal.insert( k[0].getOid(), mit.getValue().getBool() );
+		else
+			toRemove.append( k );
+	}while( mit.nextKey() );
+	if( !toRemove.isEmpty() )
+	{
+		foreach( const Udb::Mit::KeyList& kl, toRemove )
+			d_pending.setCell( kl, Stream::DataCell().setNull() );
+		d_pending.commit();
+	}
 }
 
-bool FullTextIndexer::indexIncrements( QWidget* parent )
+bool FullTextIndexer::indexIncrements( QWidget* )
 {
 	d_error.clear();
-	QString path = getIndexPath();
-	try
+	if( !exists() )
+		return false;
+	d_kick.stop();
+	onKick();
+	return true;
+}
+
+void FullTextIndexer::onKick()
+{
+	if( d_worker->isBusy() || !exists() )
+		return; // onBatchDone startet den nächsten Durchgang
+
+	FullTextWorker::Batch batch;
+	QHash<Udb::OID,bool>::const_iterator i;
+	for( i = d_journal.begin(); i != d_journal.end() && batch.size() < s_maxBatch; ++i )
 	{
-		QApplication::setOverrideCursor( Qt::WaitCursor );
-		QApplication::processEvents();
+		if( !d_inFlight.contains( i.key() ) )
+			batch.append( qMakePair( i.key(), i.value() ) );
+	}
+	if( batch.isEmpty() )
+		return;
+	for( int i = 0; i < batch.size(); i++ )
+		d_inFlight.insert( batch[i].first );
+	d_worker->enqueue( batch );
+}
 
-		const int count = calcCount2( d_pending ) * 2; // je einmal delete und dann index
-		if( count == -1 )
+void FullTextIndexer::onBatchDone()
+{
+	QString error;
+	FullTextWorker::Batch done = d_worker->takeDone( error );
+	const bool optimized = d_worker->takeOptimized();
+#ifndef _HAS_CLUCENE_
+	// Der Worker hat nur tokenisiert; geschrieben wird zusammen mit dem Journal in einem Commit
+	const QList<NativeIndex::Doc> docs = d_worker->takeDocs();
+	if( !done.isEmpty() )
+	{
+		QList<Udb::OID> removed;
+		for( int i = 0; i < done.size(); i++ )
+			removed.append( done[i].first );
+		d_native->update( removed, docs );
+	}
+#endif
+	Udb::Mit::KeyList k(1);
+	for( int i = 0; i < done.size(); i++ )
+	{
+		const Udb::OID oid = done[i].first;
+		if( !d_redirtied.contains( oid ) )
 		{
-			QApplication::restoreOverrideCursor();
-			return false;
-		}
-		QApplication::processEvents();
-		QProgressDialog progress( tr("Indexing repository..."), tr("Abort"), 0, count, parent );
-		progress.setAutoClose( false );
-		// progress.setMinimumDuration( 0 );
-		progress.setWindowTitle( tr( "Herald Search" ) );
-		progress.setWindowModality(Qt::WindowModal);
-		progress.setAutoClose( true );
-
-        QList< QPair<Udb::OID,bool> > toHandle;
-        QList<Udb::Mit::KeyList> toRemove;
-		{ // Remove outdated documents
-			QCLuceneIndexReader r = QCLuceneIndexReader::open( path );
-            Udb::Mit mit = d_pending.findCells( Udb::Obj::KeyList() );
-            if( !mit.isNull() ) do
-			{
-				Udb::Mit::KeyList k = mit.getKey();
-                if( k.size() == 1 && k[0].isOid() )
-				{
-					const int done = r.deleteDocuments(QCLuceneTerm(QLatin1String("oid"),
-                                                   QString::number( k[0].getOid(), 16 ) ) );
-                    //qDebug() << "FullTextIndexer::indexIncrements: deleting document" << k[0].getOid() << done;
-                    toHandle.append( qMakePair(k[0].getOid(), mit.getValue().getBool() ) );
-				}else
-                {
-                    //qDebug() << "FullTextIndexer::indexIncrements: invalid key" << Udb::UpdateInfo::toString(k);
-                    toRemove.append( k );
-                }
-			}while( mit.nextKey() );
-			r.close();
+			k[0].setOid( oid );
+			d_pending.setCell( k, Stream::DataCell().setNull() );
+			d_journal.remove( oid );
 		}
-		{ // Reindex
-			QCLuceneStandardAnalyzer a;
-			QCLuceneIndexWriter w( path, a, false ); // true indiziert die ganze DB
-			w.setMinMergeDocs( 1000 );
-			w.setMaxBufferedDocs( 100 );
+		d_redirtied.remove( oid );
+	}
+	d_inFlight.clear();
+	d_redirtied.clear();
+	if( optimized && error.isEmpty() )
+		d_rebuild.setValue( d_rebuild.getAtom( "LastOptimize" ),
+							Stream::DataCell().setDateTime( QDateTime::currentDateTime() ) );
+	if( !done.isEmpty() || ( optimized && error.isEmpty() ) )
+		d_pending.commit(); // auch d_rebuild, gleiche Transaction
+	if( !done.isEmpty() || optimized )
+		d_generation++; // der nächste search() öffnet einen neuen Searcher
+	emit sigPendingCount( d_journal.size() );
+	if( !error.isEmpty() )
+	{
+		// Kein automatischer Neuversuch; die Objekte bleiben im Journal bis zum nächsten Commit
+		d_error = error;
+		emit sigError( error );
+	}else if( !d_journal.isEmpty() )
+		onKick();
+}
 
-            Udb::Mit::KeyList k(1);
-            for( int i = 0; i < toHandle.size(); i++ )
-			{
-                const QPair<Udb::OID,bool>& p = toHandle[i];
-                if( p.second )
-                {
-                    Udb::Obj o = d_pending.getObject( p.first );
-                    if( !o.isNull() )
-                    {
-                        // Text updated
-                        indexItem( o, w, a );
-                    }
-                    //qDebug() << "FullTextIndexer::indexIncrements: indexing document" << p.first;
-                }
-                k[0].setOid( p.first );
-                d_pending.setCell( k, Stream::DataCell().setNull() );
-                //qDebug() << "FullTextIndexer::indexIncrements: remove pending" << p.first;
-                progress.setValue( progress.value() + 1 );
-                if( progress.wasCanceled() )
-				{
-					w.close();
-					QApplication::restoreOverrideCursor();
-					d_pending.getTxn()->rollback();
-					return false;
-				}
-			}
-            foreach( const Udb::Mit::KeyList& kl, toRemove )
-                d_pending.setCell( kl, Stream::DataCell().setNull() );
+bool FullTextIndexer::eventFilter( QObject* watched, QEvent* e )
+{
+	switch( e->type() )
+	{
+	case QEvent::KeyPress:
+	case QEvent::MouseButtonPress:
+	case QEvent::Wheel:
+		d_lastInput.restart();
+		break;
+	default:
+		break;
+	}
+	return QObject::eventFilter( watched, e );
+}
 
-		}
-		progress.setValue( count );
-		QApplication::restoreOverrideCursor();
-		d_pending.commit();
-		return true;
-	}catch( CLuceneError& e )
+FullTextIndexer::Stats FullTextIndexer::getStats()
+{
+	Stats st;
+	st.d_pending = d_journal.size();
+	// Im Repository statt in den Settings, damit es zum Index dieses Repositorys gehört
+	st.d_lastOptimize = d_rebuild.getValue( d_rebuild.getAtom( "LastOptimize" ) ).getDateTime();
+#ifdef _HAS_CLUCENE_
+	const QString path = getIndexPath();
+	// CLucene-Segmente heissen _<name>.<ext>; mehrere Dateien gehören zum selben Segment
+	QSet<QString> segs;
+	QFileInfoList files = QDir( path ).entryInfoList( QDir::Files );
+	for( int i = 0; i < files.size(); i++ )
 	{
-		QApplication::restoreOverrideCursor();
-		d_error = QString::fromLatin1( e._awhat );
-		d_pending.getTxn()->rollback();
-		return false;
+		st.d_size += files[i].size();
+		if( files[i].fileName().startsWith( QLatin1Char('_') ) )
+			segs.insert( files[i].completeBaseName() );
+	}
+	st.d_segments = segs.size();
+	if( !QCLuceneIndexReader::indexExists( path ) )
+		return st;
+	try
+	{
+		QCLuceneIndexReader r = QCLuceneIndexReader::open( path );
+		st.d_docs = r.numDocs();
+		st.d_maxDoc = r.maxDoc();
+		r.close();
+	}catch( ... )
+	{
+		qWarning() << "FullTextIndexer::getStats: cannot open index";
+	}
+#else
+	// Keine Segmente und keine gelöschten Dokumente; Einträge werden sofort entfernt
+	if( d_native->exists() )
+	{
+		st.d_docs = st.d_maxDoc = d_native->getDocCount();
+		st.d_size = d_native->getSize();
 	}
+#endif
+	return st;
+}
+
+bool FullTextIndexer::optimize()
+{
+#ifdef _HAS_CLUCENE_
+	if( !exists() )
+		return false;
+	d_worker->requestOptimize(); // nach allfälligen Batches, im Worker-Thread
+	return true;
+#else
+	return false; // der NativeIndex hat keine Segmente
+#endif
+}
+
+void FullTextIndexer::onMaintenance()
+{
+	if( d_worker->isBusy() || !d_journal.isEmpty() || d_lastInput.elapsed() < s_idleTime || !exists() )
+		return;
+	const Stats st = getStats();
+	if( st.d_segments > s_maxSegments || st.getDeletedRatio() > s_maxDeletedRatio )
+		optimize();
 }
 
 static void deletePendings( Udb::Obj& o )
@@ -352,115 +1049,1034 @@ static void deletePendings( Udb::Obj& o )
 	}while( i.nextKey() );
 }
 
-bool FullTextIndexer::indexDatabase( QWidget* parent )
+static void clearCells( Udb::Obj& o )
 {
-	d_error.clear();
-	QString path = getIndexPath();
-	try
-	{
-		QApplication::setOverrideCursor( Qt::WaitCursor );
-		QApplication::processEvents();
-		QCLuceneStandardAnalyzer a;
-		QCLuceneIndexWriter w( path, a, true );
-		w.setMinMergeDocs( 1000 );
-		w.setMaxBufferedDocs( 100 );
-
-		QApplication::processEvents();
-        QProgressDialog progress( tr("Indexing repository..."), tr("Abort"), 0,
-			d_pending.getDb()->getMaxOid(), parent );
-		progress.setAutoClose( false );
-		progress.setMinimumDuration( 0 );
-		progress.setWindowTitle( tr( "Herald Search" ) );
-		progress.setWindowModality(Qt::WindowModal);
-		progress.setAutoClose( true );
-
-        Udb::Extent e( d_pending.getTxn() );
-		if( e.first() ) do
-		{
-            Udb::Obj obj = e.getObj();
-			indexItem( obj, w, a );
-            progress.setValue( obj.getOid() );
-			if( progress.wasCanceled() )
-			{
-				w.close();
-				QDir dir( path );
-				QStringList files = dir.entryList( QDir::Files );
-				for( int i = 0; i < files.size(); i++ )
-					dir.remove( files[i] );
-				QApplication::restoreOverrideCursor();
-				return false;
-			}
-		}while( e.next() );
-        progress.setValue( d_pending.getDb()->getMaxOid() );
-		// Bei vollem Index (z.B. bei Rebuild) macht es keinen Sinn, die Pendings zu behalten
-		deletePendings(d_pending);
-		d_pending.commit();
-		QApplication::restoreOverrideCursor();
-		return true;
-	}catch( CLuceneError& e )
+	QList<Udb::Mit::KeyList> keys;
+	Udb::Mit i = o.findCells( Udb::Obj::KeyList() );
+	if( !i.isNull() ) do
 	{
-		QApplication::restoreOverrideCursor();
-		d_error = QString::fromLatin1( e._awhat );
-		d_pending.getTxn()->rollback();
-		return false;
-	}
+		keys.append( i.getKey() );
+	}while( i.nextKey() );
+	foreach( const Udb::Mit::KeyList& k, keys )
+		o.setCell( k, Stream::DataCell().setNull() );
 }
 
-bool FullTextIndexer::query( const QString& query, ResultList& result )
+// Ein Checkpoint des Rebuilds: der OID-Bereich [from,to). Mit Lucene wird er in ein eigenes
+// Verzeichnis indiziert und gilt als fertig, wenn der Writer geschlossen ist; ohne Lucene wird er
+// zusammen mit seinem Vermerk committet.
+struct _RebuildChunk
 {
-	d_error.clear();
-	QString path = getIndexPath();
-	if( !QCLuceneIndexReader::indexExists( path ) )
-	{
-		d_error = QLatin1String( "Lucene: " ) + tr("index does not exist!");
-		return false;
-	}
-	try
-	{
-		QCLuceneStandardAnalyzer a;
-		QCLuceneQuery* q = QCLuceneQueryParser::parse( query, "content", a );
-        // mit "[]" gibt es hier crash, der von keinem catch aufgehalten wird. Ursache vermutlich in
-        // CLucene\config\gunichartables.cpp cl_tolower
-		if( q )
-		{
-			result.clear();
-			QCLuceneIndexSearcher s( path );
-			QCLuceneHits hits = s.search( *q );
-			QApplication::setOverrideCursor( Qt::WaitCursor );
-			for( int i = 0; i < hits.length(); i++ )
+	int d_no;
+	Udb::OID d_from, d_to;
+	QString d_path; // nur Lucene
+};
+
+static Stream::DataCell _key( const char* name )
+{
+	return Stream::DataCell().setLatin1( name );
+}
+
+bool FullTextIndexer::hasUnfinishedRebuild() const
+{
+	return d_rebuild.getCell( Udb::Obj::KeyList() << _key( "maxOid" ) ).getOid() != 0;
+}
+
+static Udb::Obj::KeyList _chunkKey( int no )
+{
+	return Udb::Obj::KeyList() << Stream::DataCell().setUInt32( no );
+}
+
+struct _RebuildPlan
+{
+	QList<_RebuildChunk> d_todo;
+	Udb::OID d_maxOid;
+	quint64 d_doneBefore; // OIDs in bereits fertigen Chunks
+	int d_chunkCount;
+	bool d_resume;
+	bool d_merged; // nur Lucene
+};
+
+static _RebuildPlan _planRebuild( Udb::Obj& state, const QString& newPath )
+{
+	// Der OID-Raum wird in Chunks aufgeteilt; jeder fertige Chunk wird im Repository vermerkt, sodass
+	// ein abgebrochener oder abgestürzter Rebuild beim nächsten Aufruf dort weitermacht.
+	_RebuildPlan plan;
+	const Udb::Obj::KeyList kMax = Udb::Obj::KeyList() << _key( "maxOid" );
+	const Udb::Obj::KeyList kChunk = Udb::Obj::KeyList() << _key( "chunk" );
+	plan.d_maxOid = state.getCell( kMax ).getOid();
+	Udb::OID chunk = state.getCell( kChunk ).getOid();
+	plan.d_resume = plan.d_maxOid != 0 && chunk != 0;
+	if( !plan.d_resume )
+	{
+		plan.d_maxOid = state.getDb()->getMaxOid() + 1;
+		chunk = qMax( s_minChunk, plan.d_maxOid / 64 + 1 );
+		clearCells( state );
+		state.setCell( kMax, Stream::DataCell().setOid( plan.d_maxOid ) );
+		state.setCell( kChunk, Stream::DataCell().setOid( chunk ) );
+		// Änderungen ab hier werden zusätzlich in state gesammelt und nach dem Austausch ins
+		// Journal übernommen, da sie in bereits fertigen Chunks fehlen können.
+		state.commit();
+	}
+	plan.d_chunkCount = int( ( plan.d_maxOid + chunk - 1 ) / chunk );
+	plan.d_doneBefore = 0;
+	for( int i = 0; i < plan.d_chunkCount; i++ )
+	{
+		_RebuildChunk c;
+		c.d_no = i;
+		c.d_from = i * chunk;
+		c.d_to = qMin( plan.d_maxOid, c.d_from + chunk );
+		c.d_path = newPath + QString(".c%1").arg( i );
+		if( state.getCell( _chunkKey( i ) ).getBool() )
+			plan.d_doneBefore += c.d_to - c.d_from;
+		else
+			plan.d_todo.append( c );
+	}
+	plan.d_merged = state.getCell( Udb::Obj::KeyList() << _key( "merged" ) ).getBool();
+	return plan;
+}
+
+static void _replayRebuild( Udb::Obj& state, Udb::Obj& pending, QHash<Udb::OID,bool>& journal )
+{
+	// Während des Rebuilds geänderte Objekte ins Journal übernehmen und den Zustand löschen; ohne commit
+	Udb::Mit mit = state.findCells( Udb::Obj::KeyList() );
+	if( !mit.isNull() ) do
+	{
+		Udb::Mit::KeyList k = mit.getKey();
+		if( k.size() == 1 && k[0].isOid() && !journal.contains( k[0].getOid() ) )
+		{
+			pending.setCell( k, mit.getValue() );
+			journal.insert( k[0].getOid(), mit.getValue().getBool() );
+		}
+	}while( mit.nextKey() );
+	clearCells( state );
+}
+
+// Liest bis zu s_readBatch Objekte des Chunks ab from über das Extent, statt jede OID einzeln zu
+// laden; der Aufrufer hält die Database::Lock. Gibt die OID nach dem letzten gelesenen Objekt
+// zurück, bzw. to wenn der Chunk fertig ist.
+static Udb::OID _readBatch( Udb::Extent& e, Udb::OID from, Udb::OID to, QList<_ItemText>& items )
+{
+	// Zwischen zwei Batches kann ein Commit das Extent verändern, darum jedes Mal neu positionieren.
+	// Falls seek nur vorhandene Objekte trifft, liegt das nächste meist gleich dahinter.
+	bool more = false;
+	while( from < to && !( more = e.seek( from ) ) )
+		from++;
+	for( int n = 0; more && n < s_readBatch; n++ )
+	{
+		const Udb::Obj o = e.getObj();
+		if( o.getOid() >= to )
+			return to;
+		const _ItemText item = fetchItem( o );
+		if( !item.isEmpty() )
+			items.append( item );
+		from = o.getOid() + 1;
+		more = e.next();
+	}
+	return ( more ) ? from : to;
+}
+
+#ifdef _HAS_CLUCENE_
+static void removeIndexDir( const QString& path, bool rmdir )
+{
+	QDir dir( path );
+	QStringList files = dir.entryList( QDir::Files );
+	for( int i = 0; i < files.size(); i++ )
+		dir.remove( files[i] );
+	if( rmdir )
+		QDir().rmdir( path );
+}
+
+// Ein Thread des Rebuilds; arbeitet seine Chunks nacheinander ab
+class _RebuildPart : public QThread
+{
+public:
+	_RebuildPart( Udb::Database* db, const QList<_RebuildChunk>& chunks ):
+		d_db(db),d_chunks(chunks),d_done(0),d_docs(0),d_bytes(0),d_raw(0),d_cancel(false){}
+	void cancel()
+	{
+		QMutexLocker lock( &d_lock );
+		d_cancel = true;
+	}
+	void getProgress( quint64& done, quint32& docs, quint64& bytes ) const
+	{
+		QMutexLocker lock( &d_lock );
+		done = d_done;
+		docs = d_docs;
+		bytes = d_bytes;
+	}
+	QList<int> takeFinished()
+	{
+		QMutexLocker lock( &d_lock );
+		QList<int> res = d_finished;
+		d_finished.clear();
+		return res;
+	}
+	QString getError() const
+	{
+		QMutexLocker lock( &d_lock );
+		return d_error;
+	}
+	quint64 getRawBytes() const { return d_raw; } // vor der HTML-Extraktion; erst nach wait() gültig
+protected:
+	void run()
+	{
+		try
+		{
+			Udb::Transaction txn( d_db, 0 );
+			QCLuceneStandardAnalyzer a;
+			quint64 done = 0;
+			quint32 docs = 0;
+			quint64 bytes = 0;
+			foreach( const _RebuildChunk& c, d_chunks )
 			{
-				QCLuceneDocument doc = hits.document( i );
-				Hit hit;
-				hit.d_score = hits.score( i );
-				hit.d_object = d_pending.getObject( doc.get( "oid" ).toULongLong( 0, 16 ) );
-				if( hit.d_object.isNull() )
-					continue;
-				result.append( hit );
+				removeIndexDir( c.d_path, false ); // Reste eines abgebrochenen Durchgangs
+				QCLuceneIndexWriter w( c.d_path, a, true );
+				w.setMinMergeDocs( s_minMergeDocs );
+				w.setMaxBufferedDocs( s_maxBufferedDocs );
+				Udb::Extent e( &txn );
+				Udb::OID pos = c.d_from;
+				while( pos < c.d_to )
+				{
+					QList<_ItemText> items;
+					Udb::OID next;
+					{
+						// Eine Lock pro Batch; die Analyse läuft danach parallel zu den anderen Threads
+						Udb::Database::Lock lock( d_db );
+						next = _readBatch( e, pos, c.d_to, items );
+					}
+					foreach( const _ItemText& item, items )
+					{
+						int raw;
+						bytes += indexItem( item, w, a, &raw ) * sizeof(QChar);
+						d_raw += raw * sizeof(QChar);
+						docs++;
+					}
+					done += next - pos;
+					pos = next;
+					QMutexLocker lock( &d_lock );
+					d_done = done;
+					d_docs = docs;
+					d_bytes = bytes;
+					if( d_cancel )
+					{
+						// Der angefangene Chunk wird beim Fortsetzen neu erstellt
+						w.close();
+						return;
+					}
+				}
+				w.close();
+				QMutexLocker lock( &d_lock );
+				d_done = done;
+				d_docs = docs;
+				d_bytes = bytes;
+				d_finished.append( c.d_no );
+				if( d_cancel )
+					return;
+			}
+		}catch( CLuceneError& e )
+		{
+			QMutexLocker lock( &d_lock );
+			d_error = QString::fromLatin1( e._awhat );
+		}catch( std::exception& e )
+		{
+			QMutexLocker lock( &d_lock );
+			d_error = QString::fromLatin1( e.what() );
+		}
+	}
+private:
+	mutable QMutex d_lock;
+	Udb::Database* d_db;
+	QList<_RebuildChunk> d_chunks;
+	QList<int> d_finished;
+	QString d_error;
+	quint64 d_done;
+	quint32 d_docs;
+	quint64 d_bytes;
+	quint64 d_raw;
+	bool d_cancel;
+};
+
+static bool swapIndexDir( const QString& from, const QString& to )
+{
+	// Austausch ganzer Verzeichnisse: to -> to.old, from -> to, to.old löschen. Jeder Zwischenstand
+	// nach einem Absturz lässt sich am Vorhandensein von from und to erkennen und zu Ende führen;
+	// alte und neue Segmente kommen nie ins selbe Verzeichnis.
+	const QString old = to + QLatin1String(".old");
+	if( QFileInfo( from ).exists() )
+	{
+		if( QFileInfo( to ).exists() )
+		{
+			removeIndexDir( old, true ); // Rest eines früheren Austauschs
+			if( !QDir().rename( to, old ) )
+				return false;
+		}
+		if( !QDir().rename( from, to ) )
+			return false;
+	}
+	removeIndexDir( old, true );
+	return true;
+}
+
+bool FullTextIndexer::indexDatabase( QWidget* parent )
+{
+	d_error.clear();
+	const QString path = getIndexPath();
+	const QString newPath = path + QLatin1String(".new");
+	// Der bestehende Index bleibt bis zum Austausch am Schluss abfragbar und wird vom Worker
+	// weiter nachgeführt; die Chunks des neuen Index liegen in eigenen Verzeichnissen.
+
+	Udb::Database* db = d_pending.getDb();
+	const _RebuildPlan plan = _planRebuild( d_rebuild, newPath );
+	const QList<_RebuildChunk>& todo = plan.d_todo;
+	const int chunkCount = plan.d_chunkCount;
+	const Udb::OID maxOid = plan.d_maxOid;
+	const quint64 doneBefore = plan.d_doneBefore;
+	const bool merged = plan.d_merged;
+	// Beim Fortsetzen sieht der User, dass fertige Chunks übernommen werden
+	const QString title = ( plan.d_resume ) ? tr("Resuming interrupted indexing") : tr("Indexing repository");
+
+	QApplication::setOverrideCursor( Qt::WaitCursor );
+	QProgressDialog progress( title + QLatin1String("..."), tr("Abort"), 0, 1000, parent );
+	progress.setMinimumDuration( 0 );
+	progress.setWindowTitle( tr( "Herald Search" ) );
+	progress.setWindowModality(Qt::WindowModal);
+	progress.setAutoClose( false );
+
+	const int threads = qBound( 1, QThread::idealThreadCount(), 16 );
+	QList<_RebuildPart*> parts;
+	if( !merged )
+	{
+		QList< QList<_RebuildChunk> > dist;
+		for( int i = 0; i < todo.size(); i++ )
+		{
+			if( dist.size() < threads )
+				dist.append( QList<_RebuildChunk>() );
+			dist[ i % threads ].append( todo[i] );
+		}
+		for( int i = 0; i < dist.size(); i++ )
+			parts.append( new _RebuildPart( db, dist[i] ) );
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	foreach( _RebuildPart* p, parts )
+		p->start( QThread::LowPriority );
+	bool canceled = false;
+	quint32 docs = 0;
+	quint64 bytes = 0;
+	while( !parts.isEmpty() )
+	{
+		bool running = false;
+		quint64 done = doneBefore;
+		docs = 0;
+		bytes = 0;
+		bool checkpoint = false;
+		foreach( _RebuildPart* p, parts )
+		{
+			quint64 cur;
+			quint32 d;
+			quint64 b;
+			p->getProgress( cur, d, b );
+			done += cur;
+			docs += d;
+			bytes += b;
+			if( p->isRunning() )
+				running = true;
+			foreach( int no, p->takeFinished() )
+			{
+				d_rebuild.setCell( _chunkKey( no ), Stream::DataCell().setBool( true ) );
+				checkpoint = true;
+			}
+		}
+		if( checkpoint )
+			d_rebuild.commit();
+		const double secs = qMax( qint64(1), timer.elapsed() ) / 1000.0;
+		progress.setLabelText( tr("%1 with %2 threads...\n%3 documents, %4 docs/s, %5 MB/s").
+							   arg( title ).arg( parts.size() ).arg( docs ).
+							   arg( docs / secs, 0, 'f', 0 ).
+							   arg( bytes / secs / 1024.0 / 1024.0, 0, 'f', 1 ) );
+		progress.setValue( int( 1000.0 * done / double(maxOid) ) );
+		if( !running )
+			break;
+		if( progress.wasCanceled() && !canceled )
+		{
+			canceled = true;
+			foreach( _RebuildPart* p, parts )
+				p->cancel();
+		}
+		QApplication::processEvents( QEventLoop::AllEvents, 100 );
+		QThread::msleep( 50 );
+	}
+	quint64 raw = 0;
+	foreach( _RebuildPart* p, parts )
+	{
+		p->wait();
+		foreach( int no, p->takeFinished() ) // nach dem letzten Poll fertig geworden
+			d_rebuild.setCell( _chunkKey( no ), Stream::DataCell().setBool( true ) );
+		raw += p->getRawBytes();
+		if( d_error.isEmpty() )
+			d_error = p->getError();
+		delete p;
+	}
+	d_rebuild.commit();
+	if( canceled || !d_error.isEmpty() )
+	{
+		// Die fertigen Chunks bleiben erhalten; der alte Index bleibt gültig
+		QApplication::restoreOverrideCursor();
+		return false;
+	}
+
+	if( !merged )
+	{
+		try
+		{
+			progress.setLabelText( tr("Merging %1 segments...").arg( chunkCount ) );
+			QApplication::processEvents();
+			QCLuceneStandardAnalyzer a;
+			QCLuceneIndexWriter w( newPath, a, true );
+			w.setMinMergeDocs( s_minMergeDocs );
+			w.setMaxBufferedDocs( s_maxBufferedDocs );
+			QList<QCLuceneIndexReader*> readers;
+			for( int i = 0; i < chunkCount; i++ )
+				readers.append( new QCLuceneIndexReader( QCLuceneIndexReader::open(
+															 newPath + QString(".c%1").arg( i ) ) ) );
+			w.addIndexes( readers );
+			w.close();
+			foreach( QCLuceneIndexReader* r, readers )
+			{
+				r->close();
+				delete r;
 			}
+		}catch( CLuceneError& e )
+		{
+			d_error = QString::fromLatin1( e._awhat );
+			removeIndexDir( newPath, true );
 			QApplication::restoreOverrideCursor();
-			delete q;
-			return true;
-		}else
+			return false;
+		}
+		d_rebuild.setCell( Udb::Obj::KeyList() << _key( "merged" ), Stream::DataCell().setBool( true ) );
+		d_rebuild.commit();
+	}
+
+	// Austausch; erst jetzt werden Worker und Searcher des alten Index geschlossen
+	d_kick.stop();
+	d_worker->stop();
+	d_worker->wait(); // der Worker darf nicht gleichzeitig den Writer offen haben
+	d_inFlight.clear();
+	d_redirtied.clear();
+	releaseSearcher();
+	d_generation++;
+	if( !swapIndexDir( newPath, path ) )
+	{
+		// merged bleibt gesetzt; der nächste Rebuild versucht nur den Austausch erneut
+		d_error = tr("Cannot replace index directory '%1'").arg( path );
+		QApplication::restoreOverrideCursor();
+		return false;
+	}
+	for( int i = 0; i < chunkCount; i++ )
+		removeIndexDir( newPath + QString(".c%1").arg( i ), true );
+	_replayRebuild( d_rebuild, d_pending, d_journal );
+	d_rebuild.setValue( d_rebuild.getAtom( "IndexSchema" ), Stream::DataCell().setUInt32( s_indexSchema ) );
+	// addIndexes optimiert; die Dauer ist für benchmark()
+	d_rebuild.setValue( d_rebuild.getAtom( "LastOptimize" ),
+						Stream::DataCell().setDateTime( QDateTime::currentDateTime() ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildMs" ), Stream::DataCell().setUInt32( timer.elapsed() ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildDocs" ), Stream::DataCell().setUInt32( docs ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildRawKB" ), Stream::DataCell().setUInt32( raw / 1024 ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildTextKB" ), Stream::DataCell().setUInt32( bytes / 1024 ) );
+	d_rebuild.commit();
+
+	progress.setValue( 1000 );
+	emit sigPendingCount( d_journal.size() );
+	QApplication::restoreOverrideCursor();
+	if( !d_journal.isEmpty() )
+		d_kick.start();
+	return true;
+}
+
+#else
+bool FullTextIndexer::indexDatabase( QWidget* parent )
+{
+	// Ohne Lucene wird in den inaktiven Slot des NativeIndex geschrieben; der aktive bleibt bis zum
+	// Austausch abfragbar. Jeder Chunk wird zusammen mit seinem Vermerk committet.
+	d_error.clear();
+	_RebuildPlan plan = _planRebuild( d_rebuild, QString() );
+	if( !d_native->beginRebuild( !plan.d_resume ) )
+	{
+		// Der unterbrochene Rebuild hat noch im alten Format geschrieben; von vorne beginnen
+		clearCells( d_rebuild );
+		d_rebuild.commit();
+		plan = _planRebuild( d_rebuild, QString() );
+		d_native->beginRebuild( true );
+	}
+	const QString title = ( plan.d_resume ) ? tr("Resuming interrupted indexing") : tr("Indexing repository");
+
+	QApplication::setOverrideCursor( Qt::WaitCursor );
+	QProgressDialog progress( title + QLatin1String("..."), tr("Abort"), 0, 1000, parent );
+	progress.setMinimumDuration( 0 );
+	progress.setWindowTitle( tr( "Herald Search" ) );
+	progress.setWindowModality(Qt::WindowModal);
+	progress.setAutoClose( false );
+
+	QElapsedTimer timer;
+	timer.start();
+	quint64 done = plan.d_doneBefore;
+	quint32 docs = 0;
+	quint64 bytes = 0;
+	quint64 raw = 0;
+	bool canceled = false;
+	foreach( const _RebuildChunk& c, plan.d_todo )
+	{
+		QList<NativeIndex::Doc> chunk;
+		Udb::Extent e( d_pending.getTxn() );
+		Udb::OID pos = c.d_from;
+		int batches = 0;
+		while( pos < c.d_to && !canceled )
 		{
-			d_error = QLatin1String( "Lucene: " ) + tr("invalid query!");
+			QList<_ItemText> items;
+			const Udb::OID next = _readBatch( e, pos, c.d_to, items );
+			foreach( const _ItemText& item, items )
+			{
+				NativeIndex::Doc doc;
+				int r;
+				bytes += indexItem( item, doc, &r ) * sizeof(QChar);
+				raw += r * sizeof(QChar);
+				chunk.append( doc );
+				docs++;
+			}
+			done += next - pos;
+			pos = next;
+			if( ( ++batches & 0x3 ) == 0 )
+			{
+				const double secs = qMax( qint64(1), timer.elapsed() ) / 1000.0;
+				progress.setLabelText( tr("%1...\n%2 documents, %3 docs/s, %4 MB/s").
+									   arg( title ).arg( docs ).arg( docs / secs, 0, 'f', 0 ).
+									   arg( bytes / secs / 1024.0 / 1024.0, 0, 'f', 1 ) );
+				progress.setValue( int( 1000.0 * done / double(plan.d_maxOid) ) );
+				QApplication::processEvents();
+				canceled = progress.wasCanceled();
+			}
+		}
+		if( canceled )
+			break; // der angefangene Chunk wird beim Fortsetzen neu erstellt
+		d_native->appendRebuild( chunk );
+		d_rebuild.setCell( _chunkKey( c.d_no ), Stream::DataCell().setBool( true ) );
+		d_rebuild.commit();
+	}
+	if( canceled )
+	{
+		// Die fertigen Chunks sind committet; der nächste Rebuild setzt dort fort
+		QApplication::restoreOverrideCursor();
+		return false;
+	}
+
+	// Austausch; der Worker darf nicht gleichzeitig Dokumente für den alten Slot liefern
+	d_kick.stop();
+	d_worker->stop();
+	d_worker->wait();
+	d_worker->takeDocs();
+	d_inFlight.clear();
+	d_redirtied.clear();
+	d_native->finishRebuild();
+	_replayRebuild( d_rebuild, d_pending, d_journal );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildMs" ), Stream::DataCell().setUInt32( timer.elapsed() ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildDocs" ), Stream::DataCell().setUInt32( docs ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildRawKB" ), Stream::DataCell().setUInt32( raw / 1024 ) );
+	d_rebuild.setValue( d_rebuild.getAtom( "BuildTextKB" ), Stream::DataCell().setUInt32( bytes / 1024 ) );
+	d_rebuild.commit();
+	releaseSearcher();
+	d_generation++;
+
+	progress.setValue( 1000 );
+	emit sigPendingCount( d_journal.size() );
+	QApplication::restoreOverrideCursor();
+	if( !d_journal.isEmpty() )
+		d_kick.start();
+	return true;
+}
+
+#endif // _HAS_CLUCENE_
+
+#ifdef _HAS_CLUCENE_
+QCLuceneIndexSearcher* FullTextIndexer::getSearcher()
+{
+	// Throws CLuceneError
+	QMutexLocker lock( &d_searchLock );
+	if( d_searcher != 0 && d_searcherGen == d_generation )
+		return d_searcher;
+	// Zuerst den neuen öffnen, dann den alten ersetzen; schlägt das Öffnen fehl, bleibt der alte gültig
+	QCLuceneIndexReader* r = new QCLuceneIndexReader( QCLuceneIndexReader::open( getIndexPath() ) );
+	QCLuceneIndexSearcher* s = new QCLuceneIndexSearcher( *r );
+	if( d_searcher )
+		emit sigSearcherReset(); // offene Hits auf dem alten Searcher werden ungültig
+	d_cache.clear(); // Dokumentnummern gelten nur für den alten Reader
+	QCLuceneIndexSearcher* oldSearcher = d_searcher;
+	QCLuceneIndexReader* oldReader = d_reader;
+	d_searcher = s;
+	d_reader = r;
+	d_searcherGen = d_generation;
+	if( oldSearcher )
+	{
+		oldSearcher->close();
+		delete oldSearcher;
+	}
+	if( oldReader )
+	{
+		oldReader->close();
+		delete oldReader;
+	}
+	return d_searcher;
+}
+
+void FullTextIndexer::releaseSearcher()
+{
+	QMutexLocker lock( &d_searchLock );
+	if( d_searcher )
+		emit sigSearcherReset();
+	d_cache.clear();
+	try
+	{
+		if( d_searcher )
+			d_searcher->close();
+		if( d_reader )
+			d_reader->close();
+	}catch( ... )
+	{
+		qWarning() << "FullTextIndexer::releaseSearcher: error closing index";
+	}
+	delete d_searcher;
+	d_searcher = 0;
+	delete d_reader;
+	d_reader = 0;
+}
+#else
+QCLuceneIndexSearcher* FullTextIndexer::getSearcher()
+{
+	// Ohne Lucene gibt es keinen Searcher; es wird nur die Generation nachgeführt, damit Cache und
+	// Modelle gleich wie mit Lucene invalidiert werden.
+	QMutexLocker lock( &d_searchLock );
+	if( d_searcherGen != d_generation )
+	{
+		if( d_searcherGen != 0 )
+			emit sigSearcherReset();
+		d_cache.clear();
+		d_searcherGen = d_generation;
+	}
+	return 0;
+}
+
+void FullTextIndexer::releaseSearcher()
+{
+	QMutexLocker lock( &d_searchLock );
+	if( d_searcherGen != 0 )
+		emit sigSearcherReset();
+	d_cache.clear();
+	d_searcherGen = 0;
+}
+#endif
+
+static bool _isPlainTerm( const QString& t )
+{
+	// Ein Term, dessen Treffermenge unabhängig vom Rest des Queries ist
+	if( t.isEmpty() || t == QLatin1String("AND") || t == QLatin1String("OR") || t == QLatin1String("NOT") ||
+			t == QLatin1String("&&") || t == QLatin1String("||") ||
+			t.startsWith( QLatin1Char('-') ) || t.startsWith( QLatin1Char('!') ) )
+		return false;
+	for( int i = 0; i < t.size(); i++ )
+	{
+		switch( t[i].unicode() )
+		{
+		case '(': case ')': case '"': case '[': case ']': case '{': case '}': case '^':
 			return false;
 		}
+	}
+	return true;
+}
+
+static QStringList _conjunctiveTerms( const QString& query )
+{
+	// Gibt die Terme zurück, wenn das Query eine reine UND-Verknüpfung ist ("a", "a AND b",
+	// "+a +b"); sonst leer. Achtung: "a b" ist in Lucene ein ODER.
+	const QStringList tokens = query.simplified().split( QLatin1Char(' '), QString::SkipEmptyParts );
+	QStringList terms;
+	if( tokens.size() == 1 )
+	{
+		if( _isPlainTerm( tokens.first() ) )
+			terms.append( tokens.first() );
+		return terms;
+	}
+	bool allPlus = true;
+	foreach( const QString& t, tokens )
+		if( !t.startsWith( QLatin1Char('+') ) || !_isPlainTerm( t.mid( 1 ) ) )
+			allPlus = false;
+	if( allPlus )
+	{
+		foreach( const QString& t, tokens )
+			terms.append( t.mid( 1 ) );
+		return terms;
+	}
+	if( tokens.size() % 2 == 0 )
+		return QStringList();
+	for( int i = 0; i < tokens.size(); i++ )
+	{
+		if( i % 2 == 1 )
+		{
+			if( tokens[i] != QLatin1String("AND") && tokens[i] != QLatin1String("&&") )
+				return QStringList();
+		}else
+		{
+			QString t = tokens[i];
+			if( t.startsWith( QLatin1Char('+') ) )
+				t = t.mid( 1 );
+			if( !_isPlainTerm( t ) )
+				return QStringList();
+			terms.append( t );
+		}
+	}
+	return terms;
+}
+
+static QString _cacheKey( const QString& query, int order )
+{
+	const QStringList terms = _conjunctiveTerms( query );
+	const QString q = ( terms.isEmpty() ) ? query.simplified() : terms.join( QLatin1String(" AND ") );
+	return QString::number( order ) + QLatin1Char('|') + q;
+}
+
+FullTextIndexer::HitIds::~HitIds()
+{
+#ifdef _HAS_CLUCENE_
+	delete d_hits;
+	delete d_query;
+	delete d_sort;
+#endif
+}
+
+#ifdef _HAS_CLUCENE_
+static void _loadHits( FullTextIndexer::HitIds& h, int upTo )
+{
+	// Throws CLuceneError
+	// Hits::id(i) lässt Lucene die ersten 2*i TopDocs neu sammeln; darum nur so weit wie angezeigt
+	// und in ganzen Seiten, statt beim Query gleich alle Treffer zu materialisieren.
+	const int from = h.d_ids.size();
+	const int to = qMin( h.d_count, qMax( upTo, from + s_hitPage ) );
+	if( to <= from || h.d_hits == 0 )
+		return;
+	QVector<qint64> ids( to - from );
+	QVector<float> scores( to - from );
+	for( int i = from; i < to; i++ )
+	{
+		ids[i - from] = h.d_hits->id( i );
+		scores[i - from] = h.d_hits->score( i );
+	}
+	h.d_ids += ids;
+	h.d_scores += scores;
+	if( h.isComplete() )
+	{
+		delete h.d_hits;
+		h.d_hits = 0;
+		delete h.d_query;
+		h.d_query = 0;
+		delete h.d_sort;
+		h.d_sort = 0;
+	}
+}
+
+bool FullTextIndexer::runSearch( const QString& query, int order, HitRef& res )
+{
+	// Throws CLuceneError
+	QCLuceneStandardAnalyzer a;
+	QCLuceneQuery* q = QCLuceneQueryParser::parse( query, "content", a );
+	// mit "[]" gibt es hier crash, der von keinem catch aufgehalten wird. Ursache vermutlich in
+	// CLucene\config\gunichartables.cpp cl_tolower
+	if( q == 0 )
+	{
+		d_error = QLatin1String( "Lucene: " ) + tr("invalid query!");
+		return false;
+	}
+	// Query und Sort gehören ab hier dem HitIds, da die Hits damit seitenweise nachladen
+	HitRef h( new HitIds() );
+	h->d_query = q;
+	QCLuceneIndexSearcher* s = getSearcher();
+	// Die Sortierung passiert in Lucene; hits->id() lädt keine gespeicherten Felder.
+	switch( order )
+	{
+	case ByScore:
+		h->d_hits = new QCLuceneHits( s->search( *q ) );
+		break;
+	case ByDateAsc:
+		h->d_sort = new QCLuceneSort( QLatin1String("senttime"), false );
+		h->d_hits = new QCLuceneHits( s->search( *q, *h->d_sort ) );
+		break;
+	default:
+		h->d_sort = new QCLuceneSort( QLatin1String("senttime"), true );
+		h->d_hits = new QCLuceneHits( s->search( *q, *h->d_sort ) );
+		break;
+	}
+	h->d_count = h->d_hits->length();
+	h->d_gen = d_searcherGen;
+	// Nur die erste Seite; kleine Treffermengen sind damit bereits vollständig
+	_loadHits( *h, 1 );
+	res = h;
+	return true;
+}
+#else
+static bool _laterSent( const QPair<QString,int>& lhs, const QPair<QString,int>& rhs )
+{
+	return lhs.first > rhs.first;
+}
+
+static bool _earlierSent( const QPair<QString,int>& lhs, const QPair<QString,int>& rhs )
+{
+	return lhs.first < rhs.first;
+}
+
+bool FullTextIndexer::runSearch( const QString& query, int order, HitRef& res )
+{
+	getSearcher();
+	QVector<NativeIndex::Hit> hits;
+	QString error;
+	if( !d_native->search( query, hits, error ) )
+	{
+		d_error = QLatin1String( "Native: " ) + error;
+		return false;
+	}
+	const int n = hits.size();
+	res = HitRef( new HitIds() );
+	res->d_ids.resize( n );
+	res->d_scores.resize( n );
+	res->d_count = n;
+	if( order == ByScore )
+	{
+		for( int i = 0; i < n; i++ )
+		{
+			res->d_ids[i] = hits[i].d_oid;
+			res->d_scores[i] = hits[i].d_score;
+		}
+	}else
+	{
+		// Wie "senttime" bei Lucene; ohne Datum gilt "0"
+		QVector< QPair<QString,int> > keys( n );
+		for( int i = 0; i < n; i++ )
+		{
+			keys[i].first = d_native->getSent( hits[i].d_oid );
+			if( keys[i].first.isEmpty() )
+				keys[i].first = QLatin1String("0");
+			keys[i].second = i;
+		}
+		qStableSort( keys.begin(), keys.end(), ( order == ByDateAsc ) ? _earlierSent : _laterSent );
+		for( int i = 0; i < n; i++ )
+		{
+			res->d_ids[i] = hits[keys[i].second].d_oid;
+			res->d_scores[i] = hits[keys[i].second].d_score;
+		}
+	}
+	res->d_gen = d_searcherGen;
+	return true;
+}
+#endif
+
+bool FullTextIndexer::search( const QString& query, int order, HitRef& res )
+{
+	d_error.clear();
+	res.clear();
+	if( !exists() )
+	{
+		d_error = QLatin1String( engineName() ) + QLatin1String( ": " ) + tr("index does not exist!");
+		return false;
+	}
+	try
+	{
+		// Ein Treffer im Cache ist nur gültig, solange der Searcher der gleichen Generation offen ist
+		getSearcher();
+		const QString key = _cacheKey( query, order );
+		HitRef* cached = d_cache.object( key );
+		if( cached && (*cached)->d_gen == d_searcherGen )
+		{
+			d_cacheHits++;
+			res = *cached;
+			return true;
+		}
+		const QStringList terms = _conjunctiveTerms( query );
+		HitRef base;
+		if( terms.size() > 1 )
+		{
+			HitRef* b = d_cache.object( _cacheKey( terms.mid( 0, terms.size() - 1 ).join( QLatin1String(" AND ") ),
+												   order ) );
+			if( b )
+				base = *b; // Kopie, da insert() b verdrängen kann
+		}
+		bool narrowed = false;
+		// Eingrenzen lohnt nur mit vollständig geladenen Listen; alle IDs nachzuladen wäre teurer als
+		// das Query selber.
+		if( base && base->d_gen == d_searcherGen && base->isComplete() )
+		{
+			// Eingrenzung: die Treffer von "a AND b AND c" sind jene von "a AND b", die auch c enthalten.
+			// Reihenfolge und Score kommen vom gecachten Query.
+			const QString lastKey = _cacheKey( terms.last(), ByScore );
+			HitRef last;
+			HitRef* l = d_cache.object( lastKey );
+			if( l && (*l)->d_gen == d_searcherGen )
+				last = *l;
+			else
+			{
+				if( !runSearch( terms.last(), ByScore, last ) )
+					return false;
+				last->d_key = lastKey;
+				d_cache.insert( lastKey, new HitRef( last ), qMax( 1, last->d_ids.size() ) );
+			}
+			// Ein Stopwort liefert allein nichts, schränkt aber im ganzen Query auch nicht ein
+			if( last->d_count != 0 && last->isComplete() )
+			{
+				QSet<qint64> filter;
+				filter.reserve( last->d_ids.size() );
+				for( int i = 0; i < last->d_ids.size(); i++ )
+					filter.insert( last->d_ids[i] );
+				res = HitRef( new HitIds() );
+				for( int i = 0; i < base->d_ids.size(); i++ )
+				{
+					if( filter.contains( base->d_ids[i] ) )
+					{
+						res->d_ids.append( base->d_ids[i] );
+						res->d_scores.append( base->d_scores[i] );
+					}
+				}
+				res->d_count = res->d_ids.size();
+				res->d_gen = d_searcherGen;
+				narrowed = true;
+				d_cacheNarrowed++;
+			}
+		}
+		if( !narrowed && !runSearch( query, order, res ) )
+			return false;
+		res->d_key = key;
+		d_cache.insert( key, new HitRef( res ), qMax( 1, res->d_ids.size() ) );
+		return true;
+#ifdef _HAS_CLUCENE_
 	}catch( CLuceneError& e )
 	{
-		QApplication::restoreOverrideCursor();
 		d_error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e._awhat );
+#endif
+	}catch( std::exception& e )
+	{
+		d_error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e.what() );
+	}catch( ... )
+	{
+		d_error = QLatin1String( "Lucene: unknown internal error" );
+	}
+	return false;
+}
+
+bool FullTextIndexer::fetchHit( HitRef hits, int i, Udb::OID& oid, QString& sent )
+{
+#ifndef _HAS_CLUCENE_
+	// Die IDs sind bereits OIDs; das Datum steht im Dokumenteintrag
+	if( hits.isNull() || i < 0 || i >= hits->d_ids.size() )
 		return false;
-    }catch( std::exception& e )
-    {
-        QApplication::restoreOverrideCursor();
-        d_error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e.what() );
-		return false;
-    }catch( ... )
-    {
-        QApplication::restoreOverrideCursor();
-        d_error = QLatin1String( "Lucene: unknown internal error" );
+	oid = hits->d_ids[i];
+	sent = d_native->getSent( oid );
+	return true;
+#else
+	QMutexLocker lock( &d_searchLock );
+	if( hits.isNull() || d_searcher == 0 || hits->d_gen != d_searcherGen || i < 0 || i >= hits->d_count )
+		return false; // die IDs beziehen sich auf einen anderen Reader
+	try
+	{
+		if( i >= hits->d_ids.size() )
+		{
+			_loadHits( *hits, i + 1 );
+			// Cost nachführen, solange die Liste noch im Cache ist; hits ist eine Kopie, da insert()
+			// den bisherigen Eintrag löscht
+			HitRef* c = d_cache.object( hits->d_key );
+			if( c && *c == hits )
+				d_cache.insert( hits->d_key, new HitRef( hits ), hits->d_ids.size() );
+		}
+		QCLuceneDocument doc;
+		if( !d_searcher->doc( hits->d_ids[i], doc ) )
+			return false;
+		oid = doc.get( "oid" ).toULongLong( 0, 16 );
+		sent = doc.get( "senttime" ).mid( 1 ); // ohne s_sentPrefix
+		if( sent.size() < 12 )
+			sent.clear(); // Platzhalter für Objekte ohne Datum
+		return true;
+	}catch( ... )
+	{
+		qWarning() << "FullTextIndexer::fetchHit: cannot load document" << i;
 		return false;
-    }
+	}
+#endif
+}
+
+QString FullTextIndexer::benchmark( const QStringList& queries, int rounds )
+{
+	// Gleiche Ausgabe für beide Suchmaschinen; zum Vergleich dasselbe Repository einmal mit
+	// HAVE_LUCENE=true und einmal mit false bauen, neu indizieren und diesen Bericht vergleichen.
+	// Gemessen wird ohne Query-Cache bis und mit dem Laden der ersten Seite.
+	const Stats st = getStats();
+	QString res;
+	QTextStream out( &res );
+	out << "Engine: " << engineName() << endl;
+	out << "Documents: " << st.d_docs << endl;
+	out << "Index size: " << st.d_size / 1024 << " KB" << endl;
+	out << "Last rebuild: " << d_rebuild.getValue( d_rebuild.getAtom( "BuildMs" ) ).getUInt32() << " ms for " <<
+		   d_rebuild.getValue( d_rebuild.getAtom( "BuildDocs" ) ).getUInt32() << " documents" << endl;
+	out << "Rebuild text: " << d_rebuild.getValue( d_rebuild.getAtom( "BuildRawKB" ) ).getUInt32() <<
+		   " KB raw, " << d_rebuild.getValue( d_rebuild.getAtom( "BuildTextKB" ) ).getUInt32() <<
+		   " KB after HTML extraction" << endl;
+	const int page = 64;
+	foreach( const QString& q, queries )
+	{
+		if( q.trimmed().isEmpty() )
+			continue;
+		qint64 best = -1, total = 0;
+		int n = 0;
+		bool ok = true;
+		for( int r = 0; r < rounds && ok; r++ )
+		{
+			d_cache.clear();
+			QElapsedTimer timer;
+			timer.start();
+			HitRef hits;
+			ok = search( q, ByDateDesc, hits );
+			for( int i = 0; ok && i < qMin( page, hits->d_count ); i++ )
+			{
+				Udb::OID oid;
+				QString sent;
+				fetchHit( hits, i, oid, sent );
+			}
+			const qint64 us = timer.nsecsElapsed() / 1000;
+			total += us;
+			if( best < 0 || us < best )
+				best = us;
+			if( ok )
+				n = hits->d_count;
+		}
+		if( !ok )
+			out << q << ": " << d_error << endl;
+		else
+			out << q << ": " << n << " hits, best " << best << " us, average " <<
+				   total / qMax( 1, rounds ) << " us" << endl;
+	}
+	d_cache.clear();
+	return res;
+}
+
+static void _dirtyAggregates( const Udb::Obj& mail, QHash<Udb::OID,bool>& dirty )
+{
+	// Attachments und Parties erben Datum und Absender der Mail, Dokumente jenes der neusten Mail;
+	// ein bereits gelöschtes Objekt bleibt gelöscht
+	Udb::Obj sub = mail.getFirstObj();
+	if( !sub.isNull() ) do
+	{
+		if( !dirty.contains( sub.getOid() ) )
+			dirty[sub.getOid()] = true;
+		if( sub.getType() == TypeAttachment )
+		{
+			const Udb::OID doc = sub.getValue( AttrDocumentRef ).getOid();
+			if( doc != 0 && !dirty.contains( doc ) )
+				dirty[doc] = true;
+		}
+	}while( sub.next() );
 }
 
 void FullTextIndexer::onDbUpdate( Udb::UpdateInfo info )
@@ -471,26 +2087,315 @@ void FullTextIndexer::onDbUpdate( Udb::UpdateInfo info )
     // mache hier eine richtige Kopie da durch die vorliegende Funktion die Notification List
     // ergänzt wird.
     QList<Udb::UpdateInfo> updates = d_pending.getTxn()->getPendingNotifications();
-    Udb::Obj::KeyList k(1);
+    // Zuerst im Speicher zusammenfassen; pro OID zählt die letzte Änderung (true..reindex, false..gelöscht).
+    // Bei einem Import mit vielen Attributen pro Objekt würde sonst jede Notification ins Journal schreiben.
+    QHash<Udb::OID,bool> dirty;
+    int hits = 0;
     for( int i = 0; i < updates.size(); i++ )
     {
         const Udb::UpdateInfo& upd = updates[i];
         if( upd.d_kind == Udb::UpdateInfo::ValueChanged )
         {
-            if( upd.d_name == AttrText || upd.d_name == AttrBody || upd.d_name == AttrInternalId )
+            TextMatcher::invalidate( upd.d_id, upd.d_name );
+            Udb::OID oid = upd.d_id;
+            if( upd.d_name == AttrDocumentRef )
+            {
+                // Das referenzierte Dokument erhält evtl. ein neueres Datum bzw. einen neuen Absender
+                oid = d_pending.getObject( upd.d_id ).getValue( AttrDocumentRef ).getOid();
+                if( oid == 0 )
+                    continue;
+            }
+            if( upd.d_name == AttrText || upd.d_name == AttrBody || upd.d_name == AttrInternalId ||
+                    upd.d_name == AttrSentOn || upd.d_name == AttrDocumentRef )
             {
-                k[0].setOid( upd.d_id );
-                if( d_pending.getCell( k ).isNull() )
-                    d_pending.setCell( k, Stream::DataCell().setBool( true ) );
-                // NOTE: kein commit, da in Pre-Commit der Transaction, wo die Änderung stattfand
+                dirty[oid] = true;
+                hits++;
                 //qDebug() << "FullTextIndexer::onDbUpdate:" << upd.toString() << HeTypeDefs::prettyName( upd.d_name );
             }
+            if( upd.d_name == AttrSentOn || upd.d_name == AttrPartyAddr )
+            {
+                Udb::Obj o = d_pending.getObject( upd.d_id );
+                if( upd.d_name == AttrPartyAddr )
+                {
+                    // Nur der Absender geht in "from" der Mail und ihrer Aggregate
+                    if( o.getType() != TypeFromParty || o.getParent().isNull() )
+                        continue;
+                    o = o.getParent();
+                    dirty[o.getOid()] = true;
+                    hits++;
+                }
+                if( HeTypeDefs::isEmail( o.getType() ) )
+                    _dirtyAggregates( o, dirty );
+            }
         }else if( upd.d_kind == Udb::UpdateInfo::ObjectErased )
         {
-			k[0].setOid( upd.d_id );
-			d_pending.setCell( k, Stream::DataCell().setBool( false ) );
-			// NOTE: kein commit, da in Pre-Commit der Transaction, wo die Änderung stattfand
+            dirty[upd.d_id] = false;
+            hits++;
+            if( upd.d_name == TypeAttachment )
+            {
+                // Das Dokument verliert eine Referenz und evtl. sein Datum
+                const Udb::OID doc = d_pending.getObject( upd.d_id ).
+                        getValue( AttrDocumentRef, true ).getOid(); // old value
+                if( doc != 0 && !dirty.contains( doc ) )
+                    dirty[doc] = true;
+            }
             //qDebug() << "FullTextIndexer::onDbUpdate:" << upd.toString() << HeTypeDefs::prettyName( upd.d_name );
         }
     }
+    if( dirty.isEmpty() )
+        return;
+
+    // Ein Schreibvorgang pro OID und Commit, und nur wenn sich der Journaleintrag ändert
+    Udb::Obj::KeyList k(1);
+    int writes = 0;
+    QHash<Udb::OID,bool>::const_iterator i;
+    for( i = dirty.begin(); i != dirty.end(); ++i )
+    {
+        if( d_inFlight.contains( i.key() ) )
+            d_redirtied.insert( i.key() );
+        QHash<Udb::OID,bool>::iterator j = d_journal.find( i.key() );
+        if( j != d_journal.end() && j.value() == i.value() )
+            continue;
+        k[0].setOid( i.key() );
+        d_pending.setCell( k, Stream::DataCell().setBool( i.value() ) );
+        d_journal[i.key()] = i.value();
+        writes++;
+        // NOTE: kein commit, da in Pre-Commit der Transaction, wo die Änderung stattfand
+    }
+    d_writesSaved += hits - writes;
+    if( hasUnfinishedRebuild() )
+    {
+        // Diese Änderungen fehlen evtl. in bereits fertigen Chunks des neuen Index
+        for( i = dirty.begin(); i != dirty.end(); ++i )
+        {
+            k[0].setOid( i.key() );
+            d_rebuild.setCell( k, Stream::DataCell().setBool( i.value() ) );
+        }
+    }
+    // Der Commit ist erst nach dieser Funktion abgeschlossen; der Worker startet etwas später.
+    emit sigPendingCount( d_journal.size() );
+    d_kick.start();
+}
+
+FullTextWorker::FullTextWorker( Udb::Database* db, const QString& indexPath, QObject* p ):
+	QThread(p),d_db(db),d_path(indexPath),d_stop(false),d_busy(false),d_optimize(false),d_optimized(false)
+{
+	Q_ASSERT( db != 0 );
+}
+
+FullTextWorker::~FullTextWorker()
+{
+	stop();
+	wait();
+}
+
+void FullTextWorker::enqueue( const Batch& b )
+{
+	QMutexLocker lock( &d_lock );
+	d_todo += b;
+	d_busy = true;
+	d_stop = false;
+	if( !isRunning() )
+		start( QThread::LowPriority );
+	else
+		d_wake.wakeOne();
+}
+
+FullTextWorker::Batch FullTextWorker::takeDone( QString& error )
+{
+	QMutexLocker lock( &d_lock );
+	Batch res = d_done;
+	d_done.clear();
+	error = d_error;
+	d_error.clear();
+	return res;
+}
+
+void FullTextWorker::requestOptimize()
+{
+	QMutexLocker lock( &d_lock );
+	d_optimize = true;
+	d_busy = true;
+	d_stop = false;
+	if( !isRunning() )
+		start( QThread::LowPriority );
+	else
+		d_wake.wakeOne();
+}
+
+QList<NativeIndex::Doc> FullTextWorker::takeDocs()
+{
+	QMutexLocker lock( &d_lock );
+	QList<NativeIndex::Doc> res = d_docs;
+	d_docs.clear();
+	return res;
+}
+
+bool FullTextWorker::takeOptimized()
+{
+	QMutexLocker lock( &d_lock );
+	const bool res = d_optimized;
+	d_optimized = false;
+	return res;
+}
+
+bool FullTextWorker::isBusy() const
+{
+	QMutexLocker lock( &d_lock );
+	return d_busy;
+}
+
+void FullTextWorker::stop()
+{
+	QMutexLocker lock( &d_lock );
+	d_stop = true;
+	d_wake.wakeOne();
+}
+
+void FullTextWorker::run()
+{
+	// Eigene Transaction, damit der Worker nicht auf dem Zustand der GUI-Transaction arbeitet
+	Udb::Transaction txn( d_db, 0 );
+	forever
+	{
+		Batch todo;
+		bool optimize = false;
+		{
+			QMutexLocker lock( &d_lock );
+			while( d_todo.isEmpty() && !d_optimize && !d_stop )
+				d_wake.wait( &d_lock );
+			if( d_stop )
+			{
+				d_busy = false;
+				return;
+			}
+			todo = d_todo;
+			d_todo.clear();
+			optimize = todo.isEmpty() && d_optimize; // zuerst die Batches
+		}
+		if( optimize )
+			optimizeIndex();
+		else
+			indexBatch( &txn, todo );
+		{
+			QMutexLocker lock( &d_lock );
+			if( optimize )
+				d_optimize = false;
+			d_busy = !d_todo.isEmpty() || d_optimize;
+		}
+		emit sigBatchDone();
+	}
+}
+
+#ifdef _HAS_CLUCENE_
+void FullTextWorker::optimizeIndex()
+{
+	// Mischt alle Segmente zu einem und entfernt dabei die gelöschten Dokumente
+	QString error;
+	try
+	{
+		QCLuceneStandardAnalyzer a;
+		QCLuceneIndexWriter w( d_path, a, false );
+		w.setMinMergeDocs( s_minMergeDocs );
+		w.setMaxBufferedDocs( s_maxBufferedDocs );
+		w.optimize();
+		w.close();
+	}catch( CLuceneError& e )
+	{
+		error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e._awhat );
+	}catch( std::exception& e )
+	{
+		error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e.what() );
+	}catch( ... )
+	{
+		error = QLatin1String( "Lucene: unknown internal error" );
+	}
+	QMutexLocker lock( &d_lock );
+	if( error.isEmpty() )
+		d_optimized = true;
+	else
+		d_error = error;
+}
+
+void FullTextWorker::indexBatch( Udb::Transaction* txn, const Batch& todo )
+{
+	QString error;
+	try
+	{
+		{ // Remove outdated documents
+			QCLuceneIndexReader r = QCLuceneIndexReader::open( d_path );
+			for( int i = 0; i < todo.size(); i++ )
+				r.deleteDocuments(QCLuceneTerm(QLatin1String("oid"),
+											   QString::number( todo[i].first, 16 ) ) );
+			r.close();
+		}
+		{ // Reindex
+			QCLuceneStandardAnalyzer a;
+			QCLuceneIndexWriter w( d_path, a, false );
+			w.setMinMergeDocs( s_minMergeDocs );
+			w.setMaxBufferedDocs( s_maxBufferedDocs );
+			for( int i = 0; i < todo.size(); i++ )
+			{
+				if( !todo[i].second )
+					continue;
+				_ItemText item;
+				{
+					// Nur das Lesen aus der DB wird serialisiert, die Analyse läuft parallel zur GUI
+					Udb::Database::Lock lock( d_db );
+					Udb::Obj o = txn->getObject( todo[i].first );
+					if( !o.isNull() )
+						item = fetchItem( o );
+				}
+				indexItem( item, w, a );
+			}
+			w.close();
+		}
+	}catch( CLuceneError& e )
+	{
+		error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e._awhat );
+	}catch( std::exception& e )
+	{
+		error = QLatin1String( "Lucene: " ) + QString::fromLatin1( e.what() );
+	}catch( ... )
+	{
+		error = QLatin1String( "Lucene: unknown internal error" );
+	}
+	QMutexLocker lock( &d_lock );
+	if( error.isEmpty() )
+		d_done += todo;
+	else
+		d_error = error;
+}
+#else
+void FullTextWorker::optimizeIndex()
+{
+	QMutexLocker lock( &d_lock );
+	d_optimized = true; // nichts zu mischen
+}
+
+void FullTextWorker::indexBatch( Udb::Transaction* txn, const Batch& todo )
+{
+	// Hier wird nur gelesen und tokenisiert; in die Udb schreibt FullTextIndexer::onBatchDone mit der
+	// GUI-Transaction, zusammen mit dem Journal.
+	QList<NativeIndex::Doc> docs;
+	for( int i = 0; i < todo.size(); i++ )
+	{
+		if( !todo[i].second )
+			continue;
+		_ItemText item;
+		{
+			Udb::Database::Lock lock( d_db );
+			Udb::Obj o = txn->getObject( todo[i].first );
+			if( !o.isNull() )
+				item = fetchItem( o );
+		}
+		NativeIndex::Doc doc;
+		indexItem( item, doc );
+		if( !doc.isEmpty() )
+			docs.append( doc );
+	}
+	QMutexLocker lock( &d_lock );
+	d_done += todo;
+	d_docs += docs;
 }
+#endif
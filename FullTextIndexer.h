@@ -23,44 +23,210 @@
 #include <Udb/Obj.h>
 #include <QList>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QTimer>
+#include <QSet>
+#include <QHash>
+#include <QPair>
+#include <QCache>
+#include <QSharedPointer>
+#include <QVector>
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <Udb/UpdateInfo.h>
+#include "NativeIndex.h"
 
 class QWidget;
+class QCLuceneIndexReader;
+class QCLuceneIndexSearcher;
+class QCLuceneHits;
+class QCLuceneQuery;
+class QCLuceneSort;
 
 namespace He
 {
+	class FullTextWorker;
+
+	// Case-insensitive Substring-Suche mit Horspool-Skip-Table; einmal pro Pattern kompiliert.
+	// Der gefaltete Text wird pro Objekt gecacht, damit wiederholtes Weitersuchen schnell bleibt.
+	// Geänderte Texte meldet FullTextIndexer::onDbUpdate beim Commit über invalidate().
+	class TextMatcher
+	{
+	public:
+		TextMatcher( const QString& pattern = QString() );
+		~TextMatcher();
+		void setPattern( const QString& ); // kompiliert nur wenn anders
+		const QString& getPattern() const { return d_raw; }
+		bool isEmpty() const { return d_pattern.isEmpty(); }
+		int indexIn( const QString& folded ) const; // folded muss von fold() kommen
+		bool matches( const Udb::Obj&, quint32 atom ); // Text wie FullTextIndexer::fetchText
+		void clearCache() { d_cache.clear(); }
+		static QString fold( const QString& ); // simplified und case folded
+		static void invalidate( Udb::OID, quint32 atom ); // in allen TextMatcher; nur GUI-Thread
+	private:
+		Q_DISABLE_COPY(TextMatcher)
+		typedef QPair<Udb::OID,quint32> Key; // Objekt, das den Text hält, und Atom
+		QString d_raw;
+		QString d_pattern; // gefaltet
+		int d_skip[256];
+		QHash<Key,QString> d_cache; // gefalteter Text
+	};
+
 	class FullTextIndexer : public QObject
 	{
 		Q_OBJECT
 	public:
 		static const char* s_pendingUuid;
-		struct Hit
+		static const char* s_rebuildUuid; // Checkpoints eines laufenden Rebuilds
+		enum Order { ByDateDesc, ByDateAsc, ByScore };
+		struct HitIds
+		{
+			QVector<qint64> d_ids; // Lucene-Dokumentnummern bzw. OIDs (NativeIndex) in Trefferreihenfolge
+			QVector<float> d_scores;
+			int d_count; // Anzahl Hits; bei Lucene lädt fetchHit die d_ids seitenweise nach
+			quint32 d_gen; // nur gültig solange der Searcher dieser Generation offen ist
+			QString d_key; // im d_cache
+			QCLuceneHits* d_hits; // bis alle d_ids geladen sind; bei sigSearcherReset freigeben
+			// Hits::getMoreDocs sucht erneut mit Query und Sort; beide müssen leben solange d_hits
+			QCLuceneQuery* d_query;
+			QCLuceneSort* d_sort;
+			HitIds():d_count(0),d_gen(0),d_hits(0),d_query(0),d_sort(0){}
+			~HitIds();
+			bool isComplete() const { return d_ids.size() == d_count; }
+		private:
+			Q_DISABLE_COPY(HitIds)
+		};
+		typedef QSharedPointer<HitIds> HitRef; // geteilt zwischen Cache und Modellen
+		struct Stats
 		{
-			Udb::Obj d_object;
-			qreal d_score;
+			int d_segments;
+			int d_docs; // ohne gelöschte
+			int d_maxDoc; // inkl. gelöschte
+			qint64 d_size; // Bytes
+			int d_pending;
+			QDateTime d_lastOptimize;
+			Stats():d_segments(0),d_docs(0),d_maxDoc(0),d_size(0),d_pending(0){}
+			double getDeletedRatio() const { return ( d_maxDoc > 0 ) ? double( d_maxDoc - d_docs ) / d_maxDoc : 0.0; }
 		};
-		typedef QList<Hit> ResultList;
 
 		static QString fetchText( const Udb::Obj&, quint32 atom ); // not simplified, original case
-		static Udb::Obj findText( const QString& pattern, const Udb::Obj& start, bool forward = true ); 
+		static Udb::Obj findText( const QString& pattern, const Udb::Obj& start, bool forward = true );
+		static Udb::Obj findText( TextMatcher&, const Udb::Obj& start, bool forward = true );
 		static Udb::Obj gotoNext( const Udb::Obj& obj );
 		static Udb::Obj gotoPrev( const Udb::Obj& obj );
 		static Udb::Obj gotoLast( const Udb::Obj& obj ); // zuunterst
+		static QString typeName( quint32 type ); // Wert des Index-Feldes "type"
+		static QString htmlToText( const QString& ); // ohne style/script, Entities dekodiert; thread-safe
+		// Ein TypeDocument-Treffer wird auf das Attachment der neusten referenzierenden Mail abgebildet
+		static Udb::Obj resolveHit( const Udb::Obj& );
+		// Alle Attachments eines Dokuments, jenes der neusten Mail zuerst
+		static QList<Udb::Obj> findReferences( const Udb::Obj& document );
+		static int countReferences( const Udb::Obj& document );
+		static const char* engineName(); // "Lucene" oder "Native" (HAVE_LUCENE=false)
 
 		FullTextIndexer( Udb::Transaction*, QObject*  );
+		~FullTextIndexer();
 		bool exists();
 		bool hasPendingUpdates() const;
-		bool indexDatabase( QWidget* ); // Blocking
-		bool indexIncrements( QWidget* ); // Blocking
+		int getPendingCount() const { return d_journal.size(); }
+		quint64 getWritesSaved() const { return d_writesSaved; } // Journal-Schreibvorgänge dank Zusammenfassen gespart
+		bool indexDatabase( QWidget* ); // Blocking; setzt einen abgebrochenen Rebuild fort
+		bool hasUnfinishedRebuild() const;
+		bool indexIncrements( QWidget* ); // Non-blocking, hands the pending objects to the worker
 		const QString& getError() const { return d_error; }
-		bool query( const QString& query, ResultList& result );
+		// Syntax z.B. "type:inbound from:joe@example.com sent:[20240101 TO 20241231] budget";
+		// lädt noch kein Dokument, siehe SearchResultMdl. Ergebnisse werden pro Generation
+		// in einem LRU-Cache gehalten; "a AND b" wird wenn möglich aus "a" eingegrenzt.
+		bool search( const QString& query, int order, HitRef& );
+		bool fetchHit( HitRef, int i, Udb::OID&, QString& sent ); // false wenn veraltet; lädt bei Lucene IDs nach
+		Stats getStats();
+		bool optimize(); // Non-blocking, läuft im Worker
+		quint32 getCacheHits() const { return d_cacheHits; }
+		quint32 getCacheNarrowed() const { return d_cacheNarrowed; }
         QString getIndexPath() const;
         Udb::Transaction* getTxn() const { return d_pending.getTxn(); }
+		quint32 getGeneration() const { return d_generation; }
+		// Indexgrösse, Dauer des letzten Rebuilds und Latenz pro Query; für den Vergleich der Engines
+		QString benchmark( const QStringList& queries, int rounds = 5 );
+	signals:
+		void sigPendingCount( int );
+		void sigError( const QString& );
+		void sigSearcherReset(); // vor dem Schliessen des Searchers; alle Hits freigeben
 	protected slots:
 		void onDbUpdate( Udb::UpdateInfo );
+		void onKick();
+		void onBatchDone();
+		void onMaintenance();
+	protected:
+		bool eventFilter( QObject*, QEvent* );
+		void loadJournal();
+		QCLuceneIndexSearcher* getSearcher();
+		void releaseSearcher();
+		bool runSearch( const QString& query, int order, HitRef& );
 	private:
 		QString d_error;
 		Udb::Obj d_pending;
+		Udb::Obj d_rebuild;
+		NativeIndex* d_native; // nur ohne Lucene
+		QMutex d_searchLock;
+		QCLuceneIndexReader* d_reader;
+		QCLuceneIndexSearcher* d_searcher; // offen über mehrere Queries
+		quint32 d_searcherGen; // d_generation zum Zeitpunkt als d_searcher geöffnet wurde
+		quint32 d_generation; // wird bei jeder Änderung des Index erhöht
+		FullTextWorker* d_worker;
+		QTimer d_kick;
+		QTimer d_maint; // prüft periodisch, ob im Idle optimiert werden soll
+		QElapsedTimer d_lastInput;
+		QSet<Udb::OID> d_inFlight; // an den Worker übergeben, aber noch im Journal
+		QSet<Udb::OID> d_redirtied; // während inFlight erneut geändert; bleiben im Journal
+		QHash<Udb::OID,bool> d_journal; // Spiegel des persistenten Journals in d_pending
+		quint64 d_writesSaved;
+		// Key: Order|Query, Cost: Anzahl geladene IDs. Da die Lucene-Dokumentnummern nur für einen
+		// Reader gelten, wird der Cache mit jedem neuen Searcher geleert, also während der
+		// Hintergrundindizierung nach jedem Batch. Treffer gibt es v.a. beim Tippen und Sortieren.
+		QCache<QString,HitRef> d_cache;
+		quint32 d_cacheHits;
+		quint32 d_cacheNarrowed;
+	};
+
+	// Arbeitet das Journal mit eigener Transaction in einem eigenen Thread ab; nur lesend auf der DB.
+	// Das Journal selber wird ausschliesslich von FullTextIndexer im GUI-Thread geschrieben.
+	class FullTextWorker : public QThread
+	{
+		Q_OBJECT
+	public:
+		typedef QList< QPair<Udb::OID,bool> > Batch; // oid, true..reindex, false..nur löschen
+
+		FullTextWorker( Udb::Database*, const QString& indexPath, QObject* );
+		~FullTextWorker();
+		void enqueue( const Batch& );
+		void requestOptimize();
+		Batch takeDone( QString& error );
+		bool takeOptimized();
+		QList<NativeIndex::Doc> takeDocs(); // nur ohne Lucene; zu den OIDs aus takeDone()
+		bool isBusy() const;
+		void stop();
+	signals:
+		void sigBatchDone();
+	protected:
+		// Override
+		void run();
+		void indexBatch( Udb::Transaction*, const Batch& );
+		void optimizeIndex();
+	private:
+		mutable QMutex d_lock;
+		QWaitCondition d_wake;
+		Udb::Database* d_db;
+		QString d_path;
+		Batch d_todo;
+		Batch d_done;
+		QList<NativeIndex::Doc> d_docs;
+		QString d_error;
+		bool d_stop;
+		bool d_busy;
+		bool d_optimize;
+		bool d_optimized;
 	};
 }
 
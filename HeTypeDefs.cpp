@@ -361,6 +361,8 @@ QString HeTypeDefs::prettyName(quint32 type)
 		return tr("Signed");
 	case AttrUseKeyId:
 		return tr("Uses Outlook 2010");
+	case AttrFrecency:
+		return tr("Frecency");
 
         // TEST
 //    case AttrMessageId:
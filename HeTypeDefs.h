@@ -31,7 +31,7 @@ namespace He
     enum HeNumbers
 	{
 		HeStart = 0x30000,
-		HeMax = HeStart + 109,
+		HeMax = HeStart + 110,
 		HeEnd = HeStart + 1000 // Ab hier werden dynamische Atome angelegt
 	};
 
@@ -108,7 +108,8 @@ namespace He
 
         AttrUseCount = HeStart + 16, // uint32: wird bei jedem Receive (ob to, cc oder bcc) erhöht
 		AttrLastUse = HeStart + 17, // dateTime: Timestamp der letzten Verwendung in einer Party
-		AttrUseKeyId = HeStart + 109 // bool, optional, openssl cms -keyid
+		AttrUseKeyId = HeStart + 109, // bool, optional, openssl cms -keyid
+		AttrFrecency = HeStart + 110 // double, optional: log. abklingende Verwendung, siehe MailObj::touchEmailAddress
 
         // Folgende Felder sind unnötig, da redundant zur Logik (man kann alles berechnen)
         //AttrSendCount = HeStart + 18, // uint32: wird bei jedem Send (ob to, cc oder bcc) erhöht
@@ -23,10 +23,19 @@
 #include <QDir>
 #include <QtDebug>
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QUuid>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QHash>
+#include <QTextCodec>
 #include <Mail/MailMessage.h>
 #include <Udb/Idx.h>
 #include <Udb/Extent.h>
 #include "MailObj.h"
+#include "AddressCache.h"
 #include "HeraldApp.h"
 #include "HeTypeDefs.h"
 #include "ObjectHelper.h"
@@ -34,99 +43,410 @@ using namespace He;
 
 #define IMPORT_SOURCE_PATH "<set to path>"
 
-static inline bool isMailSeparator( const QByteArray& line )
+static const int s_batchMails = 500; // importEmlDir committed nach so vielen Mails,
+static const qint64 s_batchBytes = 64 * 1024 * 1024; // so vielen Bytes eml-Dateien
+static const int s_batchMs = 1000; // oder so vielen Millisekunden; solange läuft keine Event-Loop
+static const int s_reportMs = 500; // Abstand der sigStatus während dem Import
+static const char* s_pocoSeparator = "From ???@??? Sun Apr 18 12:34:56 1999"; // setzt Poco vor jede Mail
+
+MboxScanner::MboxScanner( const QString& path ):d_file( path ),d_sep( "\nFrom " ),d_map(0),d_mapOff(0),
+    d_mapLen(0),d_pos(0),d_size(0),d_poco(false)
+{
+}
+
+MboxScanner::~MboxScanner()
+{
+    unmap();
+}
+
+bool MboxScanner::open()
+{
+    if( !d_file.open( QIODevice::ReadOnly ) )
+    {
+        d_error = d_file.errorString();
+        return false;
+    }
+    d_size = d_file.size();
+    d_pos = 0;
+    if( !map( 0, qMin( d_size, s_window ) ) )
+        return false;
+    // Die erste Separatorzeile überspringen
+    if( d_mapLen >= 5 && ::memcmp( d_map, "From ", 5 ) == 0 )
+    {
+        d_poco = d_mapLen >= 37 && ::memcmp( d_map, s_pocoSeparator, 37 ) == 0;
+        const char* eol = (const char*)::memchr( d_map, '\n', d_mapLen );
+        d_pos = ( eol ) ? eol - (const char*)d_map + 1 : d_mapLen;
+    }
+    return true;
+}
+
+bool MboxScanner::map( qint64 offset, qint64 len )
+{
+    unmap();
+    if( len <= 0 )
+        return true;
+    d_map = d_file.map( offset, len );
+    if( d_map == 0 )
+    {
+        d_error = d_file.errorString();
+        return false;
+    }
+    d_mapOff = offset;
+    d_mapLen = len;
+    return true;
+}
+
+void MboxScanner::unmap()
+{
+    if( d_map )
+        d_file.unmap( d_map );
+    d_map = 0;
+    d_mapOff = 0;
+    d_mapLen = 0;
+}
+
+static bool _isBlank( const char* p, int len )
+{
+    // Wie trimmed().isEmpty(), aber ohne Kopie; bricht beim ersten Zeichen einer Mail ab
+    for( int i = 0; i < len; i++ )
+    {
+        switch( p[i] )
+        {
+        case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MboxScanner::next( QByteArray& msg )
+{
+    msg.clear(); // gibt die Referenz ins alte Mapping frei
+    qint64 window = s_window;
+    while( d_pos < d_size )
+    {
+        // Das Fenster beginnt bei der aktuellen Mail, wenn diese nicht mehr ganz darin liegt
+        if( d_map == 0 || d_pos >= d_mapOff + d_mapLen )
+        {
+            if( !map( d_pos, qMin( d_size - d_pos, window ) ) )
+                return false;
+        }
+        const char* base = (const char*)d_map;
+        const int start = int( d_pos - d_mapOff );
+        // "\nFrom " ab start - 1, damit auch eine Separatorzeile direkt am Mailbeginn gefunden wird
+        const int hit = d_sep.indexIn( base, int(d_mapLen), qMax( 0, start - 1 ) );
+        const bool atEnd = d_mapOff + d_mapLen >= d_size;
+        if( hit == -1 && !atEnd )
+        {
+            // Mail reicht über das Fenster hinaus; neu ab Mailbeginn und falls nötig grösser
+            if( d_mapOff == d_pos )
+                window *= 2;
+            unmap();
+            continue;
+        }
+        const int end = ( hit == -1 ) ? int(d_mapLen) : hit + 1;
+        const char* eol = 0;
+        if( hit != -1 )
+        {
+            eol = (const char*)::memchr( base + end, '\n', d_mapLen - end );
+            if( eol == 0 && !atEnd )
+            {
+                // Separatorzeile geht über das Fenster hinaus
+                if( d_mapOff == d_pos )
+                    window *= 2;
+                unmap();
+                continue;
+            }
+        }
+        if( hit == -1 )
+            d_pos = d_size;
+        else
+            d_pos = d_mapOff + ( ( eol ) ? eol - base + 1 : d_mapLen );
+        if( !_isBlank( base + start, end - start ) )
+        {
+            msg = QByteArray::fromRawData( base + start, end - start );
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parallele Vorbereitung für importMbx und importEmlDir: Worker parsen MIME, dekodieren Bodies und
+// Parts und berechnen die SHA1; geschrieben wird nur im GUI-Thread, der die Transaction besitzt,
+// und zwar in der Reihenfolge der Eingabe.
+struct _ParseJob
 {
-    // Folgender Code findet den Separator, den Poco vor jede Mail setzt
-    return qstrncmp( line, "From ???@??? Sun Apr 18 12:34:56 1999", 37 ) == 0;
+    int d_seq;
+    QString d_path; // eml-Datei, oder leer
+    QByteArray d_raw; // sonst die Mail selber, als eigene Kopie
+    MailMessage* d_msg;
+    MailObj::Prepared d_prep;
+    bool d_prepared;
+    bool d_accepted; // d_prep an accept übergeben; sonst löscht der Destruktor die temporären Dateien
+    QList<QByteArray> d_attHashes; // zu X-Poco-Attachment
+    _ParseJob():d_seq(0),d_msg(0),d_prepared(false),d_accepted(false){}
+    ~_ParseJob()
+    {
+        // Bei Abbruch oder Fehler bleiben sonst die dekodierten Parts im Temp-Verzeichnis liegen
+        if( !d_accepted )
+            MailObj::discardPrepared( d_prep );
+        delete d_msg;
+    }
+    void run()
+    {
+        // Jeder Job hat sein eigenes MailMessage; geteilt ist nur das Codec-Register, siehe
+        // _warmUpParser
+        d_msg = new MailMessage();
+        if( !d_path.isEmpty() )
+            d_msg->fromRFC822( LongString( d_path, false ) ); // TODO: errors
+        else
+            d_msg->fromRFC822( LongString( d_raw ) );
+        d_prepared = MailObj::prepare( d_msg, d_prep );
+        MailMessage::StringList l = d_msg->headers( "X-Poco-Attachment" );
+        foreach( QByteArray path, l )
+            d_attHashes.append( HeTypeDefs::calcHash( path ) );
+    }
+};
+
+static void _warmUpParser()
+{
+    // MailMessage sucht die Codecs der Header und Parts über QTextCodec. Dessen Register wird beim
+    // ersten Zugriff aufgebaut; das hier einmal im aufrufenden Thread auslösen, bevor die Worker
+    // starten, danach sind die Abfragen thread-safe.
+    static bool s_done = false;
+    if( s_done )
+        return;
+    s_done = true;
+    QTextCodec::availableCodecs();
+    MailMessage msg;
+    msg.fromRFC822( LongString( QByteArray(
+        "From: =?ISO-8859-1?Q?J=FCrg?= <j@example.com>\r\n"
+        "Subject: =?UTF-8?B?R3LDvHNzZQ==?=\r\n"
+        "MIME-Version: 1.0\r\n"
+        "Content-Type: text/plain; charset=windows-1252\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n\r\n"
+        "Gr=FCsse\r\n" ) ) );
+    msg.subject();
+    msg.htmlBody();
+    msg.plainTextBody();
+}
+
+class _ParsePipeline;
+
+class _ParseWorker : public QThread
+{
+public:
+    _ParseWorker( _ParsePipeline* p ):d_pipe(p){}
+protected:
+    void run();
+private:
+    _ParsePipeline* d_pipe;
+};
+
+class _ParsePipeline
+{
+public:
+    _ParsePipeline():d_stop(false)
+    {
+        _warmUpParser();
+        const int threads = qBound( 1, QThread::idealThreadCount(), 16 );
+        for( int i = 0; i < threads; i++ )
+        {
+            d_workers.append( new _ParseWorker( this ) );
+            d_workers.last()->start( QThread::LowPriority );
+        }
+    }
+    ~_ParsePipeline()
+    {
+        d_lock.lock();
+        d_stop = true;
+        d_todo.wakeAll();
+        d_lock.unlock();
+        foreach( _ParseWorker* w, d_workers )
+        {
+            w->wait();
+            delete w;
+        }
+        qDeleteAll( d_queue );
+        qDeleteAll( d_results );
+    }
+    int getMaxInFlight() const { return d_workers.size() * 4; } // begrenzt den RAM-Bedarf
+    void post( _ParseJob* job )
+    {
+        QMutexLocker lock( &d_lock );
+        d_queue.enqueue( job );
+        d_todo.wakeOne();
+    }
+    _ParseJob* take( int seq, int ms ) // 0 falls nach ms noch nicht fertig
+    {
+        QMutexLocker lock( &d_lock );
+        if( !d_results.contains( seq ) )
+            d_done.wait( &d_lock, ms );
+        return d_results.take( seq );
+    }
+    _ParseJob* fetch() // im Worker; 0 bei stop
+    {
+        QMutexLocker lock( &d_lock );
+        while( d_queue.isEmpty() && !d_stop )
+            d_todo.wait( &d_lock );
+        if( d_stop )
+            return 0;
+        return d_queue.dequeue();
+    }
+    void deliver( _ParseJob* job )
+    {
+        QMutexLocker lock( &d_lock );
+        d_results.insert( job->d_seq, job );
+        d_done.wakeAll();
+    }
+private:
+    QMutex d_lock;
+    QWaitCondition d_todo;
+    QWaitCondition d_done;
+    QQueue<_ParseJob*> d_queue;
+    QHash<int,_ParseJob*> d_results;
+    QList<_ParseWorker*> d_workers;
+    bool d_stop;
+};
+
+void _ParseWorker::run()
+{
+    while( _ParseJob* job = d_pipe->fetch() )
+    {
+        job->run();
+        d_pipe->deliver( job );
+    }
+}
+
+static void _acceptAttachments( MailObj& mail, _ParseJob* job, bool inbound )
+{
+    MailMessage::StringList l = job->d_msg->headers( "X-Poco-Attachment" );
+    for( int i = 0; i < l.size(); i++ )
+    {
+        QFileInfo info( l[i] );
+        MailObj::createAttachment( mail, l[i], info.fileName(), inbound, false,
+                                   ( i < job->d_attHashes.size() ) ? job->d_attHashes[i] : QByteArray() );
+    }
 }
 
 ImportManager::ImportManager(Udb::Transaction * txn, QObject *parent) :
-    QObject(parent),d_txn(txn)
+    QObject(parent),d_txn(txn),d_cancel(false)
 {
     Q_ASSERT( txn != 0 );
 }
 
 bool ImportManager::importMbx(const QString &path, bool inbound)
 {
-    QFile in( path );
-    if( !in.open( QIODevice::ReadOnly ) )
+    MboxScanner in( path );
+    if( !in.open() )
+    {
+        emit sigError( tr("Cannot open '%1': %2").arg( path ).arg( in.getError() ) );
         return false;
+    }
 
     Udb::Obj inbox = d_txn->getOrCreateObject( HeraldApp::s_inboxUuid, TypeInbox );
     int count = 0;
-    int msgNumber = 1;
-    while( !in.atEnd() )
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+    _ParsePipeline pipe;
+    int posted = 0;
+    int written = 0;
+    bool more = true;
+    QByteArray buf;
+    while( more || written < posted )
     {
-        QByteArray buf;
-        eatNextMail( in, buf );
-        if( !buf.isEmpty() )
-        {
-            MailMessage msg;
-            msg.fromRFC822( LongString( buf ) ); // TODO: Errors?
-            QDateTime dt = MailMessage::parseRfC822DateTime( msg.header( "Delivery-Date" ) );
-            if( dt.isValid() )
-                msg.setReceived( dt );
-
-			MailObj mail = MailObj::acceptInOrOutbound( d_txn, &msg, inbound );
-            if( !mail.isNull() )
-            {
-                MailMessage::StringList l = msg.headers( "X-Poco-Attachment" );
-                foreach( QByteArray path, l )
-                {
-                    QFileInfo info( path );
-                    MailObj::createAttachment( mail, path, info.fileName(), inbound, false );
-                }
+        while( more && posted - written < pipe.getMaxInFlight() )
+        {
+            more = in.next( buf );
+            if( !more )
+                break;
+            _ParseJob* job = new _ParseJob();
+            job->d_seq = posted++;
+            // Kopie, da das Mapping beim nächsten next() wegfallen kann
+            job->d_raw = QByteArray( buf.constData(), buf.size() );
+            if( in.isPoco() )
+                recodePocoHeader( job->d_raw ); // nur für alte Poco-Exporte
+            pipe.post( job );
+        }
+        buf.clear();
+        _ParseJob* job = pipe.take( written, 100 );
+        if( job == 0 )
+        {
+            QApplication::processEvents();
+            continue;
+        }
+        written++;
+        QDateTime dt = MailMessage::parseRfC822DateTime( job->d_msg->header( "Delivery-Date" ) );
+        if( dt.isValid() )
+            job->d_msg->setReceived( dt );
 
-                // inbox.appendSlot( mail ); // TEST
-                inbox.commit();
-                count++;
-//                QFile file( QDir( ObjectHelper::getInboxPath( d_txn ) ).absoluteFilePath(
-//                               QString("%1.eml").arg( mail.getString( AttrInternalId ) ) ) );
-//                file.open( QIODevice::WriteOnly );
-//                file.write( buf.data() );
-            }else
-            {
-                QFile file( QDir( ObjectHelper::getInboxPath( d_txn ) ).absoluteFilePath(
-                                QUuid::createUuid().toString() ) );
-                file.open( QIODevice::WriteOnly );
-                file.write( buf.data() );
-                emit sigError( tr("Error importing message '%1'").arg(msgNumber) );
-            }
+        job->d_accepted = true;
+        MailObj mail = MailObj::acceptInOrOutbound( d_txn, job->d_msg, inbound,
+                                                    ( job->d_prepared ) ? &job->d_prep : 0 );
+        if( !mail.isNull() )
+        {
+            _acceptAttachments( mail, job, inbound );
+            // inbox.appendSlot( mail ); // TEST
+            inbox.commit();
+            count++;
+        }else
+        {
+            QFile file( QDir( ObjectHelper::getInboxPath( d_txn ) ).absoluteFilePath(
+                            QUuid::createUuid().toString() ) );
+            file.open( QIODevice::WriteOnly );
+            file.write( job->d_raw );
+            emit sigError( tr("Error importing message '%1'").arg( job->d_seq + 1 ) );
+        }
+        delete job;
+        if( timer.elapsed() - lastReport >= 1000 )
+        {
+            lastReport = timer.elapsed();
+            emit sigStatus( tr("Importing %1 of %2 MB, %3").arg( in.getPos() / 1048576 ).
+                            arg( in.getSize() / 1048576 ).arg( formatRate( count, in.getPos(), lastReport ) ) );
+            QApplication::processEvents();
         }
-        msgNumber++;
     }
-    emit sigStatus( tr("Finished importing %1 messages").arg(count) );
-    return true;
+    if( !in.getError().isEmpty() )
+        emit sigError( tr("Error reading '%1': %2").arg( path ).arg( in.getError() ) );
+    emit sigStatus( tr("Finished importing %1 messages, %2").arg(count).
+                    arg( formatRate( count, in.getPos(), timer.elapsed() ) ) );
+    return in.getError().isEmpty();
 }
 
-void ImportManager::eatNextMail(QFile &in, QByteArray &out)
+QString ImportManager::formatRate( int messages, qint64 bytes, qint64 ms )
 {
+    const double secs = qMax( qint64(1), ms ) / 1000.0;
+    return tr("%1 MB/s, %2 messages/s").arg( bytes / secs / 1048576.0, 0, 'f', 1 ).
+            arg( messages / secs, 0, 'f', 0 );
+}
+
+void ImportManager::recodePocoHeader( QByteArray& buf )
+{
+    // Poco kodiert doppelt UTF-8 im Header. Darum wie bisher den ganzen Header zurückwandeln.
+    int headerEnd = buf.indexOf( "\r\n\r\n" );
+    if( headerEnd == -1 )
+        return;
+    headerEnd += 2;
     bool utf8 = false;
-    bool headerDone = false;
-    while( !in.atEnd() )
+    int pos = 0;
+    while( pos < headerEnd )
     {
-        QByteArray line = in.readLine();
-        if( isMailSeparator( line ) )
-            return;
-        else
+        int eol = buf.indexOf( '\n', pos );
+        if( eol == -1 || eol > headerEnd )
+            eol = headerEnd;
+        if( qstrnicmp( buf.constData() + pos, "Content-Type:", 13 ) == 0 )
         {
-            out.append( line );
-            if( !headerDone )
-            {
-                if( qstrnicmp( line, "Content-Type:", 13 ) == 0 )
-                {
-                    const int pos = line.indexOf( "charset=" );
-                    if( pos != -1 )
-                        utf8 = ( qstrnicmp( line.data() + pos + 9, "utf-8", 5 ) == 0 );
-                }else if( line == "\r\n" )
-                {
-                    headerDone = true;
-                    if( utf8 )
-                        out = QString::fromUtf8( out ).toLatin1();
-                }
-            }
+            const int cs = buf.indexOf( "charset=", pos );
+            if( cs != -1 && cs < eol )
+                utf8 = ( qstrnicmp( buf.constData() + cs + 9, "utf-8", 5 ) == 0 );
         }
+        pos = eol + 1;
     }
+    if( utf8 )
+        buf = QString::fromUtf8( buf.constData(), headerEnd ).toLatin1() + buf.mid( headerEnd );
 }
 
 bool ImportManager::importEmlDir(const QString &path, bool inbound )
@@ -135,53 +455,126 @@ bool ImportManager::importEmlDir(const QString &path, bool inbound )
     QStringList files = dir.entryList( QStringList() << "*.eml",
                                        QDir::Files | QDir::Readable );
     Udb::Obj inbox = d_txn->getOrCreateObject( HeraldApp::s_inboxUuid, TypeInbox );
+    d_cancel = false;
     int count = 0;
-    foreach( QString fileName, files )
+    int failed = 0;
+    AddressCache* cache = AddressCache::inst( d_txn );
+    const int uses = cache->getUses();
+    const int writes = cache->getWrites();
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+    qint64 bytes = 0;
+    // Ein Batch wird als Ganzes committed oder zurückgerollt. Die Dateien werden erst nach dem
+    // Commit umbenannt, damit nach einem Rollback oder Abbruch ein neuer Import sie wieder findet.
+    // Adressen, Message-Ids und Dokumente aus dem Batch finden accept und getOrCreateDocument über
+    // AddressCache und PendingCache; PendingCache::discard holt verschobene Anhänge zurück.
+    // Events werden nur zwischen den Batches verarbeitet. Sonst könnte z.B. InboxCtrl oder
+    // UploadManager auf d_txn einen halben Batch committen oder ihn zurückrollen.
+    QStringList batch;
+    qint64 batchBytes = 0;
+    QElapsedTimer batchTimer;
+    batchTimer.start();
+    _ParsePipeline pipe;
+    int posted = 0;
+    int written = 0;
+    while( written < files.size() && !d_cancel )
     {
-        emit sigStatus(tr("Importing file '%1'").arg(fileName) );
-        QApplication::processEvents();
-        MailObj mail;
-        {
-            MailMessage msg;
-            msg.fromRFC822( LongString( dir.absoluteFilePath( fileName ), false ) ); // TODO: errors
-            // Poco kodiert doppelt UTF-8 im Header. Darum hier rückgängig machen.
-            const int pos = msg.contentType().indexOf("charset=");
-            if( pos != 0 && msg.contentType().toLower().contains("utf-8") )
-            {
-                // RISK: bei einem Teil der importierten Mails war es bereits korrekt, bzw. die folgende
-                // Massnahme ist kontraproduktiv.
-                msg.setSubject( QString::fromUtf8( msg.subject().toLatin1() ) );
-            }
+        while( posted < files.size() && posted - written < pipe.getMaxInFlight() )
+        {
+            _ParseJob* job = new _ParseJob();
+            job->d_seq = posted;
+            job->d_path = dir.absoluteFilePath( files[posted] );
+            pipe.post( job );
+            posted++;
+        }
+        _ParseJob* job = pipe.take( written, 100 );
+        if( job == 0 )
+        {
+            if( batch.isEmpty() )
+                QApplication::processEvents();
+            continue;
+        }
+        written++;
+        const QString fileName = files[job->d_seq];
+        MailMessage* msg = job->d_msg;
+        // Poco kodiert doppelt UTF-8 im Header. Darum hier rückgängig machen.
+        const int pos = msg->contentType().indexOf("charset=");
+        if( pos != 0 && msg->contentType().toLower().contains("utf-8") )
+        {
+            // RISK: bei einem Teil der importierten Mails war es bereits korrekt, bzw. die folgende
+            // Massnahme ist kontraproduktiv.
+            msg->setSubject( QString::fromUtf8( msg->subject().toLatin1() ) );
+        }
 
-            QDateTime dt = MailMessage::parseRfC822DateTime( msg.header( "Delivery-Date" ) );
-            if( dt.isValid() )
-                msg.setReceived( dt );
-			mail = MailObj::acceptInOrOutbound( d_txn, &msg, inbound );
-            if( !mail.isNull() )
-            {
-                MailMessage::StringList l = msg.headers( "X-Poco-Attachment" );
-                foreach( QByteArray path, l )
-                {
-                    QFileInfo info( path );
-                    MailObj::createAttachment( mail, path, info.fileName(), inbound, false );
-                }
-                //inbox.appendSlot( mail ); // TEST
-            }
+        QDateTime dt = MailMessage::parseRfC822DateTime( msg->header( "Delivery-Date" ) );
+        if( dt.isValid() )
+            msg->setReceived( dt );
+        job->d_accepted = true;
+        MailObj mail = MailObj::acceptInOrOutbound( d_txn, msg, inbound,
+                                                    ( job->d_prepared ) ? &job->d_prep : 0 );
+        if( !mail.isNull() )
+        {
+            _acceptAttachments( mail, job, inbound );
+            //inbox.appendSlot( mail ); // TEST
         }
+        delete job; // schliesst die Datei
         if( !mail.isNull() )
         {
-            dir.rename( fileName, fileName + QChar('_' ) ); // Macht Kopie!
             mail.setString( mail.getAtom( "Source" ), fileName );
-            d_txn->commit();
-            count++;
+            batch.append( fileName );
+            batchBytes += QFileInfo( dir.absoluteFilePath( fileName ) ).size();
         }else
         {
+            // Einzelne Mails lassen sich nicht aus der Transaction nehmen; der ganze Batch bleibt
+            // unverändert im Verzeichnis und kann mit einem neuen Import nachgeholt werden.
             d_txn->rollback();
-            emit sigError( tr("Error importing '%1'").arg(fileName) );
+            AddressCache::discard( d_txn );
+            PendingCache::discard( d_txn );
+            emit sigError( tr("Error importing '%1', %2 files of the current batch rolled back").
+                           arg(fileName).arg( batch.size() ) );
+            failed += batch.size() + 1;
+            batch.clear();
+            batchBytes = 0;
+            batchTimer.restart();
+        }
+        if( !batch.isEmpty() && ( batch.size() >= s_batchMails || batchBytes >= s_batchBytes ||
+                                  batchTimer.elapsed() >= s_batchMs || written == files.size() ) )
+        {
+            d_txn->commit();
+            foreach( const QString& f, batch )
+                dir.rename( f, f + QChar('_' ) ); // Macht Kopie!
+            count += batch.size();
+            bytes += batchBytes;
+            batch.clear();
+            batchBytes = 0;
+            batchTimer.restart();
+        }
+        if( timer.elapsed() - lastReport >= s_reportMs )
+        {
+            lastReport = timer.elapsed();
+            emit sigStatus( tr("Importing %1 of %2 files, %3").arg( written ).arg( files.size() ).
+                            arg( formatRate( count, bytes, lastReport ) ) );
         }
+        if( batch.isEmpty() )
+            QApplication::processEvents(); // hier kann cancel() kommen
     }
-    emit sigStatus( tr("Finished importing %1 messages").arg(count) );
-    return true;
+    if( d_cancel )
+    {
+        d_txn->rollback();
+        AddressCache::discard( d_txn );
+        PendingCache::discard( d_txn );
+        emit sigError( tr("Import canceled, %1 files of the current batch rolled back").arg( batch.size() ) );
+    }
+    emit sigStatus( tr("Finished importing %1 messages (%2 failed), %3, %4 address uses in %5 address writes").
+                    arg(count).arg(failed).arg( formatRate( count, bytes, timer.elapsed() ) ).
+                    arg( cache->getUses() - uses ).arg( cache->getWrites() - writes ) );
+    return !d_cancel;
+}
+
+void ImportManager::cancel()
+{
+    d_cancel = true;
 }
 
 void ImportManager::fixOutboundAttachments(Udb::Transaction * txn)
@@ -22,13 +22,45 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QFile>
+#include <QByteArrayMatcher>
 #include <Udb/Transaction.h>
 
-class QFile;
 class QBuffer;
 
 namespace He
 {
+    // Liest eine mbox-Datei über ein gleitendes Memory-Mapping und liefert jede Mail als rohen
+    // Byte-Bereich ohne Kopie. Es ist nie mehr als ein Fenster gemappt, darum gehen auch Dateien,
+    // die grösser als RAM oder Adressraum sind.
+    class MboxScanner
+    {
+    public:
+        static const qint64 s_window = 64 * 1024 * 1024;
+
+        explicit MboxScanner( const QString& path );
+        ~MboxScanner();
+        bool open();
+        bool next( QByteArray& msg ); // msg zeigt ins Mapping und ist nur bis zum nächsten next() gültig
+        qint64 getPos() const { return d_pos; }
+        qint64 getSize() const { return d_size; }
+        bool isPoco() const { return d_poco; } // von Poco geschrieben, mit dem festen Separator
+        const QString& getError() const { return d_error; }
+    protected:
+        bool map( qint64 offset, qint64 minLen );
+        void unmap();
+    private:
+        QFile d_file;
+        QByteArrayMatcher d_sep;
+        uchar* d_map;
+        qint64 d_mapOff;
+        qint64 d_mapLen;
+        qint64 d_pos; // Beginn der nächsten Mail, nach der Separatorzeile
+        qint64 d_size;
+        QString d_error;
+        bool d_poco;
+    };
+
     class ImportManager : public QObject
     {
         Q_OBJECT
@@ -44,13 +76,17 @@ namespace He
         static void checkDocumentHash(Udb::Transaction *txn);
         static void fixDocumentHash(Udb::Transaction *txn);
         static void fixDocRedundancy(Udb::Transaction *txn);
+    public slots:
+        void cancel(); // importEmlDir rollt den laufenden Batch zurück und hört auf
     signals:
         void sigError( const QString&);
         void sigStatus( const QString& );
     protected:
-        static void eatNextMail( QFile &in, QByteArray &out );
+        static void recodePocoHeader( QByteArray& );
+        static QString formatRate( int messages, qint64 bytes, qint64 ms );
     private:
         Udb::Transaction* d_txn;
+        bool d_cancel;
     };
 }
 
@@ -36,6 +36,7 @@
 #include "HeTypeDefs.h"
 #include "ObjectHelper.h"
 #include "MailObj.h"
+#include "AddressCache.h"
 #include "HeraldApp.h"
 using namespace He;
 
@@ -201,11 +202,14 @@ void InboxCtrl::onAccept()
         if( !o.isNull() )
         {
             objs.append( o );
-            // Wir müssen bei jedem accept Commit machen, da sonst EmailAdressen mehrfach erstellt werden
+            // Doppelte EmailAdressen verhindert inzwischen der AddressCache; Commit pro Mail bleibt aber,
+            // da acceptInbound die Datei schon umbenannt hat und ein Rollback sie nicht zurückholt
             d_mdl->getQueue().getTxn()->commit();
         }else
         {
             d_mdl->getQueue().getTxn()->rollback();
+            AddressCache::discard( d_mdl->getQueue().getTxn() );
+            PendingCache::discard( d_mdl->getQueue().getTxn() );
             return;
         }
     }
@@ -30,8 +30,10 @@
 #include "HeTypeDefs.h"
 #include "ObjectHelper.h"
 #include "HeraldApp.h"
+#include "AddressCache.h"
 #include <QtDebug>
 #include <QTextDocument> // wegen Qt::escape
+#include <math.h>
 using namespace He;
 
 MailObj::MailAddr MailObj::getPartyAddr( const Udb::Obj& party, bool nameNotEmpty )
@@ -186,7 +188,50 @@ Udb::Obj MailObj::findAttachment(const QByteArray &contentId)
     return Udb::Obj();
 }
 
-bool MailObj::accept(MailMessage *msg)
+bool MailObj::prepare( MailMessage* msg, Prepared& prep )
+{
+    // Alles was accept ohne Transaction tun kann: Bodies dekodieren, Parts in Dateien, Hashes.
+    // Verschlüsselte und signierte Mails brauchen den Private Key; die macht accept selber.
+    prep = Prepared();
+    if( msg->isEncrypted() || msg->isSigned() )
+        return false;
+    msg->subject();
+    msg->htmlBody();
+    msg->plainTextBody();
+    msg->rawHeaders();
+    for( quint32 i = 0; i < msg->messagePartCount(); i++ )
+    {
+        const MailMessagePart& part = msg->messagePartAt(i);
+        QString fileName = part.sourceFilePath();
+        bool acquire = false;
+        if( fileName.isEmpty() )
+        {
+            QFile file( QDir::temp().absoluteFilePath( QUuid::createUuid().toString() ) );
+            if( !file.open( QIODevice::WriteOnly ) )
+                break; // accept macht den Rest
+            part.decodedBody( &file );
+            fileName = file.fileName();
+            acquire = true;
+            file.close();
+        }
+        prep.d_files.append( fileName );
+        prep.d_hashes.append( HeTypeDefs::calcHash( fileName ) );
+        prep.d_acquire.append( acquire );
+    }
+    return true;
+}
+
+void MailObj::discardPrepared( const Prepared& prep, int from )
+{
+    // Temporäre Dateien ab from, die accept nicht übernommen hat
+    for( int i = from; i < prep.d_files.size(); i++ )
+    {
+        if( prep.d_acquire[i] )
+            QFile::remove( prep.d_files[i] );
+    }
+}
+
+bool MailObj::accept(MailMessage *msg, const Prepared* prep )
 {
 	// bei Encrypted in Klartext übersetzen
 	if( msg->isEncrypted() )
@@ -224,6 +269,7 @@ bool MailObj::accept(MailMessage *msg)
         if( !messageId.isEmpty() && messageId[0] == '<' )
             messageId = messageId.mid( 1, messageId.size() - 2 );
         setValue( AttrMessageId, Stream::DataCell().setLatin1( messageId ) );
+        PendingCache::inst( getTxn() )->addMessage( messageId, getOid() );
 		setValue( AttrRawHeaders, Stream::DataCell().setLatin1( msg->rawHeaders() ));
 		if( msg->received().isValid() )
 			setValue( AttrReceivedOn, Stream::DataCell().setDateTime( msg->received() ) );
@@ -231,10 +277,13 @@ bool MailObj::accept(MailMessage *msg)
 	setValue( AttrSentOn, Stream::DataCell().setDateTime( msg->dateTime() ) );
     // AttrInReplyTo
     {
+        // Mails aus demselben, noch nicht committeten Import-Batch fehlen im Index
+        PendingCache* pending = PendingCache::inst( getTxn() );
         Udb::Idx idx( getTxn(), IndexDefs::IdxMessageId );
 		QByteArray msgId = msg->inReplyTo().trimmed();
         if( !msgId.isEmpty() && msgId[0] == '<' )
             msgId = msgId.mid( 1, msgId.size() - 2 );
+        bool found = false;
         if( idx.seek( Stream::DataCell().setLatin1(msgId) ) ) do
         {
             Udb::Obj m = getObject( idx.getOid() );
@@ -242,9 +291,12 @@ bool MailObj::accept(MailMessage *msg)
             {
                 // Im Prinzip könnten mehrere Objekte mit derselben MessageId existieren
                 setValue( AttrInReplyTo, m );
+                found = true;
                 break;
             }
         }while( idx.nextKey() );
+        if( !found && pending->findMessage( msgId ) != 0 && pending->findMessage( msgId ) != getOid() )
+            setValue( AttrInReplyTo, getObject( pending->findMessage( msgId ) ) );
         // else ignore
 		QList<QByteArray> refs = msg->getReferences();
         int row = 0;
@@ -252,10 +304,15 @@ bool MailObj::accept(MailMessage *msg)
         {
             if( !addr.isEmpty() && addr[0] == '<' )
                 addr = addr.mid( 1, addr.size() - 2 );
+            Udb::OID ref = 0;
             if( idx.seek( Stream::DataCell().setLatin1(addr) ) )
+                ref = idx.getOid();
+            else
+                ref = pending->findMessage( addr );
+            if( ref != 0 )
             {
                 setCell( Udb::Obj::KeyList() << Stream::DataCell().setAtom(AttrReference) <<
-                    Stream::DataCell().setUInt8( row ), Stream::DataCell().setOid( idx.getOid() ) );
+                    Stream::DataCell().setUInt8( row ), Stream::DataCell().setOid( ref ) );
                 row++;
             }
         }
@@ -315,23 +372,40 @@ bool MailObj::accept(MailMessage *msg)
 	for( quint32 i = 0; i < msg->messagePartCount(); i++ )
     {
 		const MailMessagePart& part = msg->messagePartAt(i);
-        QString fileName = part.sourceFilePath();
+        QString fileName;
+        QByteArray hash;
         bool acquire = false;
-        if( fileName.isEmpty() )
+        if( prep != 0 && int(i) < prep->d_files.size() )
         {
-            QFile file( QDir::temp().absoluteFilePath( QUuid::createUuid().toString() ) );
-            if( !file.open( QIODevice::WriteOnly ) )
-                return false;
-            part.decodedBody( &file );
-            fileName = file.fileName();
-            acquire = true;
-            file.close();
+            fileName = prep->d_files[i];
+            hash = prep->d_hashes[i];
+            acquire = prep->d_acquire[i];
+        }else
+        {
+            fileName = part.sourceFilePath();
+            if( fileName.isEmpty() )
+            {
+                QFile file( QDir::temp().absoluteFilePath( QUuid::createUuid().toString() ) );
+                if( !file.open( QIODevice::WriteOnly ) )
+                    return false;
+                part.decodedBody( &file );
+                fileName = file.fileName();
+                acquire = true;
+                file.close();
+            }
         }
 
         Q_ASSERT( i < toDispose.size() );
-        AttachmentObj att = createAttachment( *this, fileName, part.prettyName(), acquire, toDispose[i] );
+        AttachmentObj att = createAttachment( *this, fileName, part.prettyName(), acquire, toDispose[i], hash );
         if( att.isNull() )
+        {
+            // Die Datei konnte nicht übernommen werden; sie und die restlichen Parts aufräumen
+            if( acquire )
+                QFile::remove( fileName );
+            if( prep != 0 )
+                discardPrepared( *prep, int(i) + 1 );
             return false;
+        }
         att.setValue( AttrInlineDispo, Stream::DataCell().setBool( part.isInline() ) );
         att.setContentId( part.contentID() );
     }
@@ -375,11 +449,12 @@ Udb::Obj MailObj::acceptInbound(Udb::Transaction* txn, const QByteArray& stream
 	return acceptInOrOutbound( txn, &msg, true );
 }
 
-Udb::Obj MailObj::acceptInOrOutbound(Udb::Transaction* txn, MailMessage *msg, bool inbound )
+Udb::Obj MailObj::acceptInOrOutbound(Udb::Transaction* txn, MailMessage *msg, bool inbound,
+                                     const Prepared* prep )
 {
     Q_ASSERT( txn != 0 );
     MailObj mailObj = ObjectHelper::createObject( (inbound)?TypeInboundMessage:TypeOutboundMessage, txn );
-    mailObj.accept( msg );
+    mailObj.accept( msg, prep );
     return mailObj;
 }
 
@@ -437,8 +512,7 @@ bool MailObj::acceptDraftParty(const Udb::Obj &draftParty, MailMessage* msg)
         {
             partyObj.setValueAsObj( AttrPartyAddr, addrObj );
             partyObj.setValueAsObj( AttrPartyPers, addrObj.getParent() );
-            addrObj.incCounter( AttrUseCount );
-            addrObj.setTimeStamp( AttrLastUse );
+            touchEmailAddress( addrObj );
         }
         partyObj.setValue( AttrPartyDate, Stream::DataCell().setDateTime(
                 QDateTime::currentDateTime().toUTC() ) );
@@ -463,35 +537,83 @@ bool MailObj::acceptDraftParty(const Udb::Obj &draftParty, MailMessage* msg)
 
 Udb::Obj MailObj::getOrCreateEmailAddress(Udb::Transaction* txn, const QByteArray &addr, const QString &name)
 {
-    const QByteArray fixedAddr = addr.toLower().trimmed();
+    const QByteArray fixedAddr = AddressCache::normalize( addr );
     Q_ASSERT( txn != 0 );
     if( fixedAddr.isEmpty() )
         return Udb::Obj();
-    Udb::Idx idx( txn, IndexDefs::IdxEmailAddress );
-    Udb::Obj addrObj;
-    if( idx.seek( Stream::DataCell().setLatin1( fixedAddr, false ) ) )
-        addrObj = txn->getObject( idx.getOid() );
+    // Der Cache kennt auch Adressen, die in dieser Transaction erstellt und noch nicht im Index sind
+    AddressCache* cache = AddressCache::inst( txn );
+    Udb::Obj addrObj = cache->find( fixedAddr );
     if( addrObj.isNull() )
     {
         addrObj = ObjectHelper::createObject( TypeEmailAddress, txn );
         addrObj.setValue( AttrEmailAddress, Stream::DataCell().setLatin1( fixedAddr, false ) );
         if( name.compare( addr, Qt::CaseInsensitive ) != 0 ) // wenn name==addr speichern wir keinen Namen
             addrObj.setString( AttrText, name );
+        cache->insert( fixedAddr, addrObj );
     }
     return addrObj;
 }
 
 Udb::Obj MailObj::getEmailAddress(Udb::Transaction * txn, const QByteArray &addr)
 {
-    QByteArray fixedAddr = addr.toLower().trimmed();
+    QByteArray fixedAddr = AddressCache::normalize( addr );
     Q_ASSERT( !fixedAddr.isEmpty() );
     if( fixedAddr[0] == '<' )
         fixedAddr = fixedAddr.mid( 1, fixedAddr.size() - 2 );
     Q_ASSERT( txn != 0 );
-    Udb::Idx idx( txn, IndexDefs::IdxEmailAddress );
-    if( idx.seek( Stream::DataCell().setLatin1( fixedAddr ) ) )
-        return txn->getObject( idx.getOid() );
-    return Udb::Obj();
+    return AddressCache::inst( txn )->find( fixedAddr );
+}
+
+// Frecency = log( Summe über alle Verwendungen von 2^((t - t0) / Halbwertszeit) ). Da alle Adressen
+// dieselbe Zeitachse haben, bleibt die Reihenfolge ohne periodisches Neuberechnen richtig, und der
+// Logarithmus hält die Werte auch nach Jahrzehnten klein.
+static const double s_halfLifeDays = 30.0;
+static const double s_noUse = -1.0e9;
+
+double MailObj::getUseWeight( const QDateTime& t )
+{
+    static const QDateTime t0( QDate( 2000, 1, 1 ), QTime( 0, 0 ), Qt::UTC );
+    return double( t0.secsTo( t ) ) / ( s_halfLifeDays * 86400.0 ) * 0.69314718055994531; // ln 2
+}
+
+double MailObj::getFrecency( const Udb::Obj& addr )
+{
+    const Stream::DataCell f = addr.getValue( AttrFrecency );
+    if( !f.isNull() )
+        return f.getDouble();
+    // Adressen von vor AttrFrecency: alle Verwendungen zum Zeitpunkt der letzten
+    const quint32 count = addr.getValue( AttrUseCount ).getUInt32();
+    const QDateTime lastUse = addr.getValue( AttrLastUse ).getDateTime();
+    if( count == 0 || !lastUse.isValid() )
+        return s_noUse;
+    return ::log( double( count ) ) + getUseWeight( lastUse );
+}
+
+double MailObj::addFrecency( double a, double b )
+{
+    if( a <= s_noUse )
+        return b;
+    if( b <= s_noUse )
+        return a;
+    return qMax( a, b ) + ::log( 1.0 + ::exp( -qAbs( a - b ) ) ); // log( e^a + e^b )
+}
+
+void MailObj::touchEmailAddress( Udb::Obj& addr )
+{
+    // Bei Bulk-Accept kommt dieselbe Adresse oft vor; geschrieben wird einmal pro Commit
+    AddressCache::inst( addr.getTxn() )->touch( addr );
+}
+
+void MailObj::writeEmailAddressUse( Udb::Obj& addr, quint32 count, const QDateTime& lastUse,
+                                    double frecency )
+{
+    const double f = addFrecency( getFrecency( addr ), frecency );
+    addr.setValue( AttrUseCount, Stream::DataCell().setUInt32(
+                       addr.getValue( AttrUseCount ).getUInt32() + count ) );
+    if( lastUse.isValid() )
+        addr.setValue( AttrLastUse, Stream::DataCell().setDateTime( lastUse ) );
+    addr.setValue( AttrFrecency, Stream::DataCell().setDouble( f ) );
 }
 
 Udb::Obj MailObj::createParty(Udb::Obj &mail, const QByteArray &addr, const QString &name, quint32 type)
@@ -503,8 +625,7 @@ Udb::Obj MailObj::createParty(Udb::Obj &mail, const QByteArray &addr, const QStr
     {
         partyObj.setValueAsObj( AttrPartyAddr, addrObj );
         partyObj.setValueAsObj( AttrPartyPers, addrObj.getParent() );
-        addrObj.incCounter( AttrUseCount );
-        addrObj.setTimeStamp( AttrLastUse );
+        touchEmailAddress( addrObj );
     }
     partyObj.setValue( AttrPartyDate, mail.getValue( AttrSentOn ) );
     if( !name.isEmpty() )
@@ -516,23 +637,27 @@ Udb::Obj MailObj::createParty(Udb::Obj &mail, const QByteArray &addr, const QStr
 }
 
 Udb::Obj MailObj::getOrCreateDocument(Udb::Transaction * txn, const QString &filePath,
-        const QString &name, bool acquire, bool toDispose )
+        const QString &name, bool acquire, bool toDispose, const QByteArray& precalc )
 {
     // Diese Routine ist robust gegenüber inexistenten filePath; in diesem Fall ist hash.isEmpty()
     Q_ASSERT( txn != 0 );
-    const QByteArray hash = HeTypeDefs::calcHash( filePath );
+    const QByteArray hash = ( precalc.isEmpty() ) ? HeTypeDefs::calcHash( filePath ) : precalc;
+    PendingCache* pending = PendingCache::inst( txn );
     Udb::Obj doc;
     if( hash.length() != 0 )
     {
         Udb::Idx idx( txn, IndexDefs::IdxFileHash );
         if( idx.seek( Stream::DataCell().setLob( hash ) ) )
             doc = txn->getObject( idx.getOid() );
+        else if( pending->findDocument( hash ) != 0 ) // im selben Batch erstellt
+            doc = txn->getObject( pending->findDocument( hash ) );
     }
     if( doc.isNull() )
     {
         doc = ObjectHelper::createObject( TypeDocument, txn );
         doc.setValue( AttrFileHash, Stream::DataCell().setLob( hash ) );
         doc.setString( AttrText, name );
+        pending->addDocument( hash, doc.getOid() );
         if( acquire )
         {
             if( hash.length() != 0 )
@@ -542,6 +667,8 @@ Udb::Obj MailObj::getOrCreateDocument(Udb::Transaction * txn, const QString &fil
                     f.remove();
                 else if( !f.rename( AttachmentObj::getFilePath( doc ) ) )
                     return Udb::Obj();
+                else
+                    pending->addMovedFile( filePath, AttachmentObj::getFilePath( doc ) );
             }
         }else
             doc.setString( AttrFilePath, filePath );
@@ -555,7 +682,8 @@ Udb::Obj MailObj::getOrCreateDocument(Udb::Transaction * txn, const QString &fil
             {
                 // Wenn wir nicht wegwerfen wollen, aber die existierende Datei bereits gelöscht wurde,
                 // nehmen wir stattdessen wieder die neue Datei anstelle der alten.
-                newFile.rename( oldFile.fileName() );
+                if( newFile.rename( oldFile.fileName() ) )
+                    pending->addMovedFile( filePath, oldFile.fileName() );
             }else
                 newFile.remove();
         }else
@@ -565,10 +693,10 @@ Udb::Obj MailObj::getOrCreateDocument(Udb::Transaction * txn, const QString &fil
 }
 
 Udb::Obj MailObj::createAttachment(Udb::Obj &mail, const QString &filePath, const QString &name,
-        bool acquire, bool toDispose )
+        bool acquire, bool toDispose, const QByteArray& hash )
 {
     Q_ASSERT( !mail.isNull() );
-    Udb::Obj doc = getOrCreateDocument( mail.getTxn(), filePath, name, acquire, toDispose );
+    Udb::Obj doc = getOrCreateDocument( mail.getTxn(), filePath, name, acquire, toDispose, hash );
     if( doc.isNull() )
         return Udb::Obj();
     Udb::Obj att = mail.createAggregate( TypeAttachment );
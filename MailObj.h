@@ -21,6 +21,7 @@
 */
 
 #include <Udb/Obj.h>
+#include <QStringList>
 
 class MailMessage;
 
@@ -52,6 +53,12 @@ namespace He
         };
         typedef QList<MailAddr> MailAddrList;
         typedef QList<AttachmentObj> Attachments;
+        struct Prepared // Resultat von prepare(); pro MessagePart Datei und SHA1; siehe discardPrepared
+        {
+            QStringList d_files;
+            QList<QByteArray> d_hashes;
+            QList<bool> d_acquire; // true..temporäre Datei mit dem dekodierten Part
+        };
 
         MailObj(const Udb::Obj& o ):Obj( o ) {}
         MailObj() {}
@@ -70,21 +77,32 @@ namespace He
         Udb::Obj createAttachment( const QString& filePath, const QString& name, bool acquire, bool toDispose );
         Udb::Obj findAttachment( const QByteArray& contentId );
 
-		bool accept( MailMessage* msg );
+		bool accept( MailMessage* msg, const Prepared* = 0 );
+        static bool prepare( MailMessage* msg, Prepared& ); // ohne Transaction, darum in Worker-Threads
+        static void discardPrepared( const Prepared&, int from = 0 ); // falls nicht an accept übergeben
 
         static Udb::Obj acceptInbound(Udb::Transaction* txn, const QString& path );
         static Udb::Obj acceptInbound(Udb::Transaction* txn, const QByteArray& stream );
-		static Udb::Obj acceptInOrOutbound(Udb::Transaction* txn, MailMessage* msg, bool inbound );
+		static Udb::Obj acceptInOrOutbound(Udb::Transaction* txn, MailMessage* msg, bool inbound,
+                                           const Prepared* = 0 );
         static Udb::Obj acceptOutbound(const Udb::Obj& draft, MailMessage* msg );
         static bool acceptDraftParty( const Udb::Obj& draftParty, MailMessage* msg );
         static Udb::Obj getOrCreateEmailAddress( Udb::Transaction*,const QByteArray& addr, const QString& name );
         static Udb::Obj getEmailAddress( Udb::Transaction*, const QByteArray& addr );
+        static void touchEmailAddress( Udb::Obj& addr ); // AttrUseCount, AttrLastUse und AttrFrecency
+        static void writeEmailAddressUse( Udb::Obj& addr, quint32 count, const QDateTime& lastUse,
+                                          double frecency ); // via AddressCache beim Commit
+        static double getFrecency( const Udb::Obj& addr ); // Rang für Vorschläge, höher ist besser
+        static double getUseWeight( const QDateTime& utc ); // Beitrag einer Verwendung, log-Skala
+        static double addFrecency( double, double ); // log( e^a + e^b )
         static MailAddr getPartyAddr( const Udb::Obj& party, bool nameNotEmpty );
         static Udb::Obj createParty( Udb::Obj& mail, const QByteArray& addr, const QString& name, quint32 type );
         static Udb::Obj getOrCreateDocument( Udb::Transaction*, const QString& filePath,
-                                             const QString& name, bool acquire, bool toDispose );
+                                             const QString& name, bool acquire, bool toDispose,
+                                             const QByteArray& hash = QByteArray() ); // sonst calcHash
         static Udb::Obj createAttachment( Udb::Obj& mail, const QString& filePath,
-                                             const QString& name, bool acquire, bool toDispose );
+                                             const QString& name, bool acquire, bool toDispose,
+                                             const QByteArray& hash = QByteArray() );
 		static Udb::Obj getOrCreateIdentity( const Udb::Obj& addr, const QString& name, bool create = true );
         static QString formatAddress( const Udb::Obj& addrOrParty, bool rfc822 ); // Address oder Party
         static void adjustInReplyTo(Udb::Transaction* txn);
@@ -0,0 +1,777 @@
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "NativeIndex.h"
+#include <Udb/Transaction.h>
+#include <QSet>
+#include <QMap>
+#include <QObject>
+#include <QtDebug>
+#include <math.h>
+using namespace He;
+
+const char* NativeIndex::s_anchorUuid = "{C1E5D0A2-7B64-4f1e-A93D-2E8B6F0C4D71}";
+static const char* s_slotUuid[2] = { "{5F3A9C1B-0E27-4b8d-9A6F-D41C2B7E8053}",
+									 "{8D0B4E6F-2A19-4c73-B5E8-1F7C3A9D6024}" };
+
+static const int s_maxTermLen = 64; // längere "Wörter" sind meist Base64 oder URLs
+static const quint32 s_maxTf = 0x0fffffff;
+static const int s_blockSize = 256; // Postings pro Block; ein Block wird ab doppelter Grösse geteilt
+static const quint32 s_format = 2; // 2: Posting-Listen in Blöcken
+
+// Zellen in einem Slot; die Schlüssel sind rohe Bytes, damit Präfixe mit findCells gehen
+static const char s_termKey = 'T'; // 'T' + UTF-8 Term + '\0' + erste OID big-endian -> Lob Block
+static const char s_docKey = 'D'; // 'D' + OID -> Lob Dokumenteintrag
+static const char* s_countKey = "N"; // Anzahl Dokumente
+static const char* s_formatKey = "F"; // s_format, mit dem der Slot geschrieben wurde
+// Zellen im Anker
+static const char* s_activeKey = "A"; // Nummer des aktiven Slots
+static const char* s_builtKey = "B"; // true nach dem ersten vollständigen Rebuild
+
+static void _writeVarint( QByteArray& out, quint64 v )
+{
+	while( v >= 0x80 )
+	{
+		out += char( ( v & 0x7f ) | 0x80 );
+		v >>= 7;
+	}
+	out += char( v );
+}
+
+static bool _readVarint( const QByteArray& in, int& pos, quint64& v )
+{
+	v = 0;
+	int shift = 0;
+	while( pos < in.size() && shift < 64 )
+	{
+		const quint8 b = quint8( in[pos++] );
+		v |= quint64( b & 0x7f ) << shift;
+		if( ( b & 0x80 ) == 0 )
+			return true;
+		shift += 7;
+	}
+	return false;
+}
+
+static QByteArray _encodePostings( const NativeIndex::Postings& l )
+{
+	// Anzahl, dann pro Dokument OID-Differenz und tf << 4 | Felder; die OIDs sind aufsteigend
+	QByteArray res;
+	res.reserve( l.size() * 3 + 4 );
+	_writeVarint( res, l.size() );
+	Udb::OID prev = 0;
+	for( int i = 0; i < l.size(); i++ )
+	{
+		_writeVarint( res, l[i].d_oid - prev );
+		_writeVarint( res, ( quint64( l[i].d_tf ) << 4 ) | l[i].d_fields );
+		prev = l[i].d_oid;
+	}
+	return res;
+}
+
+static NativeIndex::Postings _decodePostings( const QByteArray& in )
+{
+	NativeIndex::Postings res;
+	int pos = 0;
+	quint64 n;
+	if( !_readVarint( in, pos, n ) )
+		return res;
+	res.reserve( n );
+	Udb::OID prev = 0;
+	for( quint64 i = 0; i < n; i++ )
+	{
+		quint64 delta, tf;
+		if( !_readVarint( in, pos, delta ) || !_readVarint( in, pos, tf ) )
+		{
+			qWarning() << "NativeIndex: corrupt posting list";
+			break;
+		}
+		NativeIndex::Posting p;
+		p.d_oid = prev + delta;
+		p.d_tf = tf >> 4;
+		p.d_fields = tf & 0xf;
+		res.append( p );
+		prev = p.d_oid;
+	}
+	return res;
+}
+
+static QByteArray _encodeDoc( const NativeIndex::Doc& doc )
+{
+	// Datum, dann die Terme, damit update() das Dokument aus genau diesen Listen entfernen kann
+	QByteArray res;
+	const QByteArray sent = doc.d_sent.toLatin1();
+	_writeVarint( res, sent.size() );
+	res += sent;
+	_writeVarint( res, doc.d_terms.size() );
+	QHash<QString,quint32>::const_iterator i;
+	for( i = doc.d_terms.begin(); i != doc.d_terms.end(); ++i )
+	{
+		const QByteArray t = i.key().toUtf8();
+		_writeVarint( res, t.size() );
+		res += t;
+	}
+	return res;
+}
+
+static bool _decodeDoc( const QByteArray& in, QString* sent, QStringList* terms )
+{
+	int pos = 0;
+	quint64 len;
+	if( !_readVarint( in, pos, len ) || pos + int(len) > in.size() )
+		return false;
+	if( sent )
+		*sent = QString::fromLatin1( in.mid( pos, len ) );
+	pos += len;
+	if( terms == 0 )
+		return true;
+	quint64 n;
+	if( !_readVarint( in, pos, n ) )
+		return false;
+	for( quint64 i = 0; i < n; i++ )
+	{
+		if( !_readVarint( in, pos, len ) || pos + int(len) > in.size() )
+			return false;
+		terms->append( QString::fromUtf8( in.constData() + pos, len ) );
+		pos += len;
+	}
+	return true;
+}
+
+static QByteArray _termKey( const QString& term )
+{
+	// Präfix aller Terme, die mit term beginnen
+	return s_termKey + term.toUtf8();
+}
+
+static QByteArray _blockPrefix( const QString& term )
+{
+	// Präfix der Blöcke genau dieses Terms; '\0' kommt in Termen nicht vor und sortiert vor allem
+	return _termKey( term ) + '\0';
+}
+
+static QByteArray _blockKey( const QByteArray& prefix, Udb::OID start )
+{
+	QByteArray res = prefix;
+	for( int i = 7; i >= 0; i-- )
+		res += char( ( start >> ( i * 8 ) ) & 0xff );
+	return res;
+}
+
+static Udb::OID _blockStart( const QByteArray& key )
+{
+	Udb::OID res = 0;
+	for( int i = key.size() - 8; i < key.size(); i++ )
+		res = ( res << 8 ) | quint8( key[i] );
+	return res;
+}
+
+static QByteArray _termPart( const QByteArray& key )
+{
+	const int sep = key.indexOf( '\0', 1 );
+	return key.mid( 1, ( ( sep < 0 ) ? key.size() : sep ) - 1 );
+}
+
+static bool _readTerm( Udb::Xit& xit, NativeIndex::Postings* l )
+{
+	// Liest alle Blöcke des Terms, auf dem xit steht, und setzt xit auf den nächsten Term.
+	// Gibt false zurück, wenn keiner mehr folgt. Mit l == 0 werden die Blöcke nur übersprungen.
+	const QByteArray term = _termPart( xit.getKey() );
+	do
+	{
+		if( l )
+			*l += _decodePostings( xit.getValue().getArr() );
+		if( !xit.nextKey() )
+			return false;
+	}while( _termPart( xit.getKey() ) == term );
+	return true;
+}
+
+static QByteArray _docKey( Udb::OID oid )
+{
+	return s_docKey + Stream::DataCell().setOid( oid ).writeCell();
+}
+
+static Stream::DataCell _getCell( const Udb::Obj& o, const QByteArray& key )
+{
+	// findCells liefert alle Schlüssel mit diesem Präfix; der kürzeste kommt zuerst
+	Udb::Xit xit = o.findCells( key );
+	if( !xit.isNull() && xit.getKey() == key )
+		return xit.getValue();
+	return Stream::DataCell();
+}
+
+static bool _isStopWord( const QString& w )
+{
+	// Die englische Liste des StandardAnalyzers von Lucene, damit sich beide Builds gleich verhalten
+	static const char* s_stop[] = { "a", "an", "and", "are", "as", "at", "be", "but", "by", "for",
+		"if", "in", "into", "is", "it", "no", "not", "of", "on", "or", "such", "that", "the", "their",
+		"then", "there", "these", "they", "this", "to", "was", "will", "with", 0 };
+	if( w.size() > 5 )
+		return false;
+	for( int i = 0; s_stop[i] != 0; i++ )
+		if( w == QLatin1String( s_stop[i] ) )
+			return true;
+	return false;
+}
+
+QStringList NativeIndex::tokenize( const QString& text )
+{
+	// Buchstaben und Ziffern, klein geschrieben, ohne Stopwörter
+	QStringList res;
+	const QChar* p = text.constData();
+	const QChar* const end = p + text.size();
+	while( p < end )
+	{
+		while( p < end && !p->isLetterOrNumber() )
+			p++;
+		const QChar* start = p;
+		while( p < end && p->isLetterOrNumber() )
+			p++;
+		const int len = p - start;
+		if( len == 0 || len > s_maxTermLen )
+			continue;
+		const QString w = QString( start, len ).toLower();
+		if( !_isStopWord( w ) )
+			res.append( w );
+	}
+	return res;
+}
+
+void NativeIndex::Doc::addText( const QString& text, Field f )
+{
+	const QStringList words = tokenize( text );
+	for( int i = 0; i < words.size(); i++ )
+	{
+		quint32& v = d_terms[ words[i] ];
+		const quint32 tf = qMin( ( v >> 4 ) + 1, s_maxTf );
+		v = ( tf << 4 ) | ( v & 0xf ) | f;
+	}
+}
+
+void NativeIndex::Doc::addKey( const char* field, const QString& value )
+{
+	// Untokenisiert wie bei Lucene; das ':' kommt in tokenisierten Termen nicht vor
+	if( !value.isEmpty() )
+		d_terms.insert( QLatin1String( field ) + QLatin1Char(':') + value.toLower(), 1 << 4 );
+}
+
+NativeIndex::NativeIndex( Udb::Transaction* txn )
+{
+	Q_ASSERT( txn != 0 );
+	d_anchor = txn->getOrCreateObject( QUuid( s_anchorUuid ) );
+	d_active = getSlot( true );
+	txn->commit();
+}
+
+Udb::Obj NativeIndex::getSlot( bool active ) const
+{
+	const quint32 a = _getCell( d_anchor, s_activeKey ).getUInt32() & 1;
+	return d_anchor.getTxn()->getOrCreateObject( QUuid( s_slotUuid[ ( active ) ? a : 1 - a ] ) );
+}
+
+bool NativeIndex::exists() const
+{
+	// Ein Index im alten Format (eine Lob pro Term) muss neu aufgebaut werden
+	return _getCell( d_anchor, s_builtKey ).getBool() &&
+			_getCell( d_active, s_formatKey ).getUInt32() == s_format;
+}
+
+int NativeIndex::getDocCount() const
+{
+	return _getCell( d_active, s_countKey ).getUInt32();
+}
+
+qint64 NativeIndex::getSize() const
+{
+	qint64 res = 0;
+	Udb::Xit xit = d_active.findCells( QByteArray() );
+	if( !xit.isNull() ) do
+	{
+		res += xit.getKey().size() + xit.getValue().getArr().size();
+	}while( xit.nextKey() );
+	return res;
+}
+
+void NativeIndex::update( const QList<Udb::OID>& removed, const QList<Doc>& docs )
+{
+	apply( d_active, removed, docs );
+}
+
+static bool _lessOid( const NativeIndex::Posting& lhs, const NativeIndex::Posting& rhs )
+{
+	return lhs.d_oid < rhs.d_oid;
+}
+
+static int _findBlock( const QVector<Udb::OID>& starts, Udb::OID oid )
+{
+	// Der letzte Block, der nicht nach oid beginnt; kleinere OIDs kommen in den ersten Block
+	int lo = 0, hi = starts.size();
+	while( hi - lo > 1 )
+	{
+		const int mid = ( lo + hi ) / 2;
+		if( starts[mid] <= oid )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void _writeBlock( Udb::Obj& slot, const QByteArray& prefix, const QByteArray& key,
+						 const NativeIndex::Postings& l )
+{
+	// Ein neuer oder leerer Block hat noch keinen Schlüssel. Der erste Teil behält den bisherigen
+	// Schlüssel, damit die Grenze zum vorangehenden Block gleich bleibt.
+	if( l.isEmpty() )
+	{
+		if( !key.isEmpty() )
+			slot.setCell( key, Stream::DataCell().setNull() );
+		return;
+	}
+	const int step = ( l.size() > 2 * s_blockSize ) ? s_blockSize : l.size();
+	for( int i = 0; i < l.size(); i += step )
+	{
+		const QByteArray k = ( i == 0 && !key.isEmpty() ) ? key : _blockKey( prefix, l[i].d_oid );
+		slot.setCell( k, Stream::DataCell().setLob( _encodePostings( l.mid( i, step ) ) ) );
+	}
+}
+
+void NativeIndex::apply( Udb::Obj& slot, const QList<Udb::OID>& removed, const QList<Doc>& docs )
+{
+	// Zuerst pro Term sammeln, damit jeder Block pro Aufruf nur einmal gelesen und geschrieben
+	// wird, auch wenn viele Dokumente denselben Term haben.
+	QHash<QString, QSet<Udb::OID> > drop;
+	QHash<QString,Postings> add;
+	int count = _getCell( slot, s_countKey ).getUInt32();
+	for( int i = 0; i < removed.size(); i++ )
+	{
+		const QByteArray key = _docKey( removed[i] );
+		const Stream::DataCell rec = _getCell( slot, key );
+		if( rec.isNull() )
+			continue;
+		QStringList terms;
+		_decodeDoc( rec.getArr(), 0, &terms );
+		foreach( const QString& t, terms )
+			drop[t].insert( removed[i] );
+		slot.setCell( key, Stream::DataCell().setNull() );
+		count--;
+	}
+	for( int i = 0; i < docs.size(); i++ )
+	{
+		const Doc& doc = docs[i];
+		if( doc.isEmpty() )
+			continue;
+		const QByteArray key = _docKey( doc.d_oid );
+		if( _getCell( slot, key ).isNull() )
+			count++;
+		slot.setCell( key, Stream::DataCell().setLob( _encodeDoc( doc ) ) );
+		QHash<QString,quint32>::const_iterator j;
+		for( j = doc.d_terms.begin(); j != doc.d_terms.end(); ++j )
+		{
+			Posting p;
+			p.d_oid = doc.d_oid;
+			p.d_tf = j.value() >> 4;
+			p.d_fields = j.value() & 0xf;
+			add[j.key()].append( p );
+			drop[j.key()].insert( doc.d_oid ); // falls das Dokument schon drin war
+		}
+	}
+	QSet<QString> terms = drop.keys().toSet();
+	terms.unite( add.keys().toSet() );
+	foreach( const QString& t, terms )
+	{
+		// Nur die Schlüssel lesen; dekodiert werden nur die Blöcke, in denen sich etwas ändert
+		const QByteArray prefix = _blockPrefix( t );
+		QList<QByteArray> keys;
+		QVector<Udb::OID> starts;
+		Udb::Xit xit = slot.findCells( prefix );
+		if( !xit.isNull() ) do
+		{
+			keys.append( xit.getKey() );
+			starts.append( _blockStart( keys.last() ) );
+		}while( xit.nextKey() );
+		QMap<int, QSet<Udb::OID> > skip;
+		QMap<int,Postings> in;
+		if( !keys.isEmpty() )
+		{
+			foreach( Udb::OID oid, drop.value( t ) )
+				skip[ _findBlock( starts, oid ) ].insert( oid );
+		}
+		const Postings a = add.value( t );
+		for( int i = 0; i < a.size(); i++ )
+			in[ ( keys.isEmpty() ) ? 0 : _findBlock( starts, a[i].d_oid ) ].append( a[i] );
+		QSet<int> blocks = skip.keys().toSet();
+		blocks.unite( in.keys().toSet() );
+		foreach( int n, blocks )
+		{
+			const QByteArray key = ( keys.isEmpty() ) ? QByteArray() : keys[n];
+			const Postings old = ( key.isEmpty() ) ? Postings() :
+													 _decodePostings( _getCell( slot, key ).getArr() );
+			const QSet<Udb::OID> s = skip.value( n );
+			Postings b = in.value( n );
+			qSort( b.begin(), b.end(), _lessOid );
+			// Mischen; beide Folgen sind nach OID sortiert
+			Postings res;
+			res.reserve( old.size() + b.size() );
+			int i = 0, j = 0;
+			while( i < old.size() || j < b.size() )
+			{
+				if( i < old.size() && s.contains( old[i].d_oid ) )
+					i++;
+				else if( j >= b.size() || ( i < old.size() && old[i].d_oid < b[j].d_oid ) )
+					res.append( old[i++] );
+				else
+					res.append( b[j++] );
+			}
+			_writeBlock( slot, prefix, key, res );
+		}
+	}
+	slot.setCell( QByteArray( s_countKey ), Stream::DataCell().setUInt32( qMax( 0, count ) ) );
+}
+
+bool NativeIndex::beginRebuild( bool fresh )
+{
+	Udb::Obj slot = getSlot( false );
+	if( !fresh )
+		return _getCell( slot, s_formatKey ).getUInt32() == s_format;
+	Udb::Transaction* txn = d_anchor.getTxn();
+	slot.erase(); // löscht auch alle Zellen
+	slot = getSlot( false );
+	slot.setCell( QByteArray( s_formatKey ), Stream::DataCell().setUInt32( s_format ) );
+	txn->commit();
+	return true;
+}
+
+void NativeIndex::appendRebuild( const QList<Doc>& docs )
+{
+	Udb::Obj slot = getSlot( false );
+	apply( slot, QList<Udb::OID>(), docs );
+}
+
+void NativeIndex::finishRebuild()
+{
+	Udb::Obj old = d_active;
+	const quint32 a = _getCell( d_anchor, s_activeKey ).getUInt32() & 1;
+	d_anchor.setCell( QByteArray( s_activeKey ), Stream::DataCell().setUInt32( 1 - a ) );
+	d_anchor.setCell( QByteArray( s_builtKey ), Stream::DataCell().setBool( true ) );
+	d_active = d_anchor.getTxn()->getOrCreateObject( QUuid( s_slotUuid[ 1 - a ] ) );
+	old.erase(); // wird beim nächsten Rebuild neu angelegt
+}
+
+NativeIndex::Postings NativeIndex::readPostings( const QString& term ) const
+{
+	Postings res;
+	Udb::Xit xit = d_active.findCells( _blockPrefix( term ) );
+	if( !xit.isNull() )
+		_readTerm( xit, &res );
+	return res;
+}
+
+QString NativeIndex::getSent( Udb::OID oid ) const
+{
+	QString res;
+	_decodeDoc( _getCell( d_active, _docKey( oid ) ).getArr(), &res, 0 );
+	return res;
+}
+
+namespace
+{
+	struct _Clause
+	{
+		enum Occur { Should, Must, MustNot };
+		Occur d_occur;
+		QString d_field; // klein; leer für content
+		QString d_text;
+		QString d_from, d_to; // nur Range
+		bool d_prefix, d_phrase, d_range;
+		_Clause():d_occur(Should),d_prefix(false),d_phrase(false),d_range(false){}
+	};
+	typedef QHash<Udb::OID,float> _Scores;
+}
+
+static bool _parse( const QString& query, QList<_Clause>& res, QString& error )
+{
+	const QChar* p = query.constData();
+	const QChar* const end = p + query.size();
+	bool andNext = false, notNext = false;
+	while( p < end )
+	{
+		while( p < end && ( p->isSpace() || *p == QLatin1Char('(') || *p == QLatin1Char(')') ) )
+			p++; // Klammern werden ignoriert
+		if( p >= end )
+			break;
+		_Clause c;
+		if( *p == QLatin1Char('+') )
+		{
+			c.d_occur = _Clause::Must;
+			p++;
+		}else if( *p == QLatin1Char('-') || *p == QLatin1Char('!') )
+		{
+			c.d_occur = _Clause::MustNot;
+			p++;
+		}
+		const QChar* start = p;
+		while( p < end && ( p->isLetterOrNumber() || *p == QLatin1Char('_') ) )
+			p++;
+		if( p < end && p > start && *p == QLatin1Char(':') )
+		{
+			c.d_field = QString( start, p - start ).toLower();
+			p++;
+		}else
+			p = start;
+		if( p < end && *p == QLatin1Char('"') )
+		{
+			start = ++p;
+			while( p < end && *p != QLatin1Char('"') )
+				p++;
+			c.d_text = QString( start, p - start );
+			c.d_phrase = true;
+			if( p < end )
+				p++;
+		}else if( p < end && ( *p == QLatin1Char('[') || *p == QLatin1Char('{') ) )
+		{
+			start = ++p;
+			while( p < end && *p != QLatin1Char(']') && *p != QLatin1Char('}') )
+				p++;
+			const QStringList r = QString( start, p - start ).simplified().split( QLatin1Char(' ') );
+			if( p < end )
+				p++;
+			if( r.size() != 3 || r[1] != QLatin1String("TO") )
+			{
+				error = QObject::tr("invalid range");
+				return false;
+			}
+			c.d_from = r[0].toLower();
+			c.d_to = r[2].toLower();
+			c.d_range = true;
+		}else
+		{
+			start = p;
+			while( p < end && !p->isSpace() && *p != QLatin1Char(')') )
+				p++;
+			c.d_text = QString( start, p - start );
+			if( c.d_field.isEmpty() && c.d_occur == _Clause::Should )
+			{
+				if( c.d_text == QLatin1String("AND") || c.d_text == QLatin1String("&&") )
+				{
+					if( !res.isEmpty() && res.last().d_occur == _Clause::Should )
+						res.last().d_occur = _Clause::Must;
+					andNext = true;
+					continue;
+				}
+				if( c.d_text == QLatin1String("OR") || c.d_text == QLatin1String("||") )
+					continue;
+				if( c.d_text == QLatin1String("NOT") )
+				{
+					notNext = true;
+					continue;
+				}
+			}
+			if( c.d_text.endsWith( QLatin1Char('*') ) )
+			{
+				c.d_text.chop( 1 );
+				c.d_prefix = true;
+			}
+		}
+		if( notNext )
+			c.d_occur = _Clause::MustNot;
+		else if( andNext && c.d_occur == _Clause::Should )
+			c.d_occur = _Clause::Must;
+		andNext = notNext = false;
+		res.append( c );
+	}
+	return true;
+}
+
+static int _fieldMask( const QString& field )
+{
+	if( field.isEmpty() || field == QLatin1String("content") )
+		return NativeIndex::AllFields;
+	if( field == QLatin1String("subject") )
+		return NativeIndex::Subject;
+	if( field == QLatin1String("body") )
+		return NativeIndex::Body;
+	if( field == QLatin1String("ident") )
+		return NativeIndex::Ident;
+	if( field == QLatin1String("attachment") )
+		return NativeIndex::Attachment;
+	return 0;
+}
+
+static bool _isKeyField( const QString& field )
+{
+	return field == QLatin1String("type") || field == QLatin1String("from") || field == QLatin1String("sent");
+}
+
+static void _addPostings( _Scores& res, const NativeIndex::Postings& l, int mask, int docCount )
+{
+	// tf-idf; gross genug, dass seltene Terme bei ODER-Queries nach vorne kommen
+	if( l.isEmpty() )
+		return;
+	const float idf = ::log( 1.0 + double( qMax( docCount, l.size() ) ) / l.size() );
+	for( int i = 0; i < l.size(); i++ )
+	{
+		if( ( l[i].d_fields & mask ) == 0 )
+			continue;
+		res[ l[i].d_oid ] += ( 1.0 + ::log( double( qMax( quint32(1), l[i].d_tf ) ) ) ) * idf;
+	}
+}
+
+static void _intersect( _Scores& lhs, const _Scores& rhs )
+{
+	_Scores::iterator i = lhs.begin();
+	while( i != lhs.end() )
+	{
+		_Scores::const_iterator j = rhs.find( i.key() );
+		if( j == rhs.end() )
+			i = lhs.erase( i );
+		else
+		{
+			i.value() += j.value();
+			++i;
+		}
+	}
+}
+
+static bool _lessHit( const NativeIndex::Hit& lhs, const NativeIndex::Hit& rhs )
+{
+	if( lhs.d_score != rhs.d_score )
+		return lhs.d_score > rhs.d_score;
+	return lhs.d_oid > rhs.d_oid; // neuere Objekte zuerst
+}
+
+bool NativeIndex::search( const QString& query, QVector<Hit>& hits, QString& error ) const
+{
+	hits.clear();
+	QList<_Clause> clauses;
+	if( !_parse( query, clauses, error ) )
+		return false;
+	const int docCount = getDocCount();
+	QList<_Scores> must;
+	QList<_Scores> should;
+	QSet<Udb::OID> excluded;
+	foreach( const _Clause& c, clauses )
+	{
+		_Scores s;
+		if( _isKeyField( c.d_field ) )
+		{
+			const QString prefix = c.d_field + QLatin1Char(':');
+			if( c.d_range || c.d_prefix )
+			{
+				// Alle Werte des Felds in Sortierreihenfolge; bei sent ist das chronologisch
+				const QByteArray key = _termKey( prefix + ( c.d_prefix ? c.d_text.toLower() : QString() ) );
+				Udb::Xit xit = d_active.findCells( key );
+				bool more = !xit.isNull();
+				while( more )
+				{
+					const QString v = QString::fromUtf8( _termPart( xit.getKey() ) ).mid( prefix.size() );
+					const bool inRange = !c.d_range || ( v >= c.d_from && v <= c.d_to );
+					Postings l;
+					more = _readTerm( xit, ( inRange ) ? &l : 0 );
+					_addPostings( s, l, AllFields, docCount );
+				}
+			}else
+				_addPostings( s, readPostings( prefix + c.d_text.toLower() ), AllFields, docCount );
+		}else
+		{
+			const int mask = _fieldMask( c.d_field );
+			const QStringList words = tokenize( c.d_text );
+			if( mask == 0 || c.d_range )
+			{
+				error = QObject::tr("unknown field '%1'").arg( c.d_field );
+				return false;
+			}
+			if( words.isEmpty() )
+				continue; // nur Stopwörter; schränkt wie bei Lucene nichts ein
+			if( c.d_prefix && words.size() == 1 )
+			{
+				Udb::Xit xit = d_active.findCells( _termKey( words.first() ) );
+				bool more = !xit.isNull();
+				while( more )
+				{
+					const bool plain = !_termPart( xit.getKey() ).contains( ':' );
+					Postings l;
+					more = _readTerm( xit, ( plain ) ? &l : 0 );
+					_addPostings( s, l, mask, docCount );
+				}
+			}else
+			{
+				// Phrasen und zusammengesetzte Wörter wie "foo-bar": alle Wörter, ohne Positionen
+				_addPostings( s, readPostings( words.first() ), mask, docCount );
+				for( int i = 1; i < words.size() && !s.isEmpty(); i++ )
+				{
+					_Scores t;
+					_addPostings( t, readPostings( words[i] ), mask, docCount );
+					_intersect( s, t );
+				}
+			}
+		}
+		switch( c.d_occur )
+		{
+		case _Clause::Must:
+			must.append( s );
+			break;
+		case _Clause::MustNot:
+			excluded.unite( s.keys().toSet() );
+			break;
+		default:
+			should.append( s );
+			break;
+		}
+	}
+	_Scores res;
+	if( !must.isEmpty() )
+	{
+		res = must.first();
+		for( int i = 1; i < must.size(); i++ )
+			_intersect( res, must[i] );
+		foreach( const _Scores& s, should )
+		{
+			_Scores::const_iterator j;
+			for( j = s.begin(); j != s.end(); ++j )
+			{
+				_Scores::iterator k = res.find( j.key() );
+				if( k != res.end() )
+					k.value() += j.value();
+			}
+		}
+	}else
+	{
+		foreach( const _Scores& s, should )
+		{
+			_Scores::const_iterator j;
+			for( j = s.begin(); j != s.end(); ++j )
+				res[ j.key() ] += j.value();
+		}
+	}
+	hits.reserve( res.size() );
+	_Scores::const_iterator i;
+	for( i = res.begin(); i != res.end(); ++i )
+	{
+		if( excluded.contains( i.key() ) )
+			continue;
+		Hit h;
+		h.d_oid = i.key();
+		h.d_score = i.value();
+		hits.append( h );
+	}
+	qSort( hits.begin(), hits.end(), _lessHit );
+	return true;
+}
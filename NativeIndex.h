@@ -0,0 +1,90 @@
+#ifndef __He_NativeIndex__
+#define __He_NativeIndex__
+
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <Udb/Obj.h>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+
+namespace He
+{
+	// Invertierter Index in Udb-Zellen, die Suchmaschine für Builds ohne Lucene (HAVE_LUCENE=false).
+	// Pro Term eine Posting-Liste mit delta- und varint-kodierten OIDs, aufgeteilt in Blöcke nach OID,
+	// damit ein Update nur die betroffenen Blöcke neu schreibt; pro Dokument ein Eintrag mit Datum
+	// und Termen, damit es ohne Suche in allen Listen wieder entfernt werden kann.
+	// Es gibt zwei Slots, damit ein Rebuild den aktiven Index bis zum Austausch nicht berührt.
+	// Schreibt nur in die Transaction; commit ist Sache des Aufrufers.
+	class NativeIndex
+	{
+	public:
+		enum Field { Subject = 1, Body = 2, Ident = 4, Attachment = 8, AllFields = 15 };
+		struct Doc
+		{
+			Udb::OID d_oid;
+			QString d_sent; // yyyyMMddhhmm oder leer
+			QHash<QString,quint32> d_terms; // Term -> tf << 4 | Field-Maske
+			Doc():d_oid(0){}
+			void addText( const QString&, Field );
+			void addKey( const char* field, const QString& value ); // untokenisiert, z.B. type:inbound
+			bool isEmpty() const { return d_terms.isEmpty(); }
+		};
+		struct Posting
+		{
+			Udb::OID d_oid;
+			quint32 d_tf;
+			quint8 d_fields;
+		};
+		typedef QVector<Posting> Postings;
+		struct Hit
+		{
+			Udb::OID d_oid;
+			float d_score;
+		};
+
+		static const char* s_anchorUuid;
+
+		explicit NativeIndex( Udb::Transaction* );
+		bool exists() const; // mindestens ein vollständiger Rebuild im aktuellen Format
+		void update( const QList<Udb::OID>& removed, const QList<Doc>& ); // im aktiven Slot
+		// Query-Syntax wie Lucene, aber ohne Klammern und Positionen: Terme, "+", "-", AND/OR/NOT,
+		// feld:term, Präfix*, "Phrase" (alle Wörter), sent:[von TO bis]. Sortiert nach Score.
+		bool search( const QString& query, QVector<Hit>&, QString& error ) const;
+		QString getSent( Udb::OID ) const;
+		int getDocCount() const;
+		qint64 getSize() const; // Bytes in Posting-Listen und Dokumenteinträgen
+
+		bool beginRebuild( bool fresh ); // fresh leert den inaktiven Slot; false wenn nicht fortsetzbar
+		void appendRebuild( const QList<Doc>& ); // in den inaktiven Slot
+		void finishRebuild(); // macht den inaktiven Slot aktiv und leert den alten
+
+		static QStringList tokenize( const QString& );
+	protected:
+		Udb::Obj getSlot( bool active ) const;
+		static void apply( Udb::Obj& slot, const QList<Udb::OID>& removed, const QList<Doc>& );
+		Postings readPostings( const QString& term ) const;
+	private:
+		Udb::Obj d_anchor;
+		Udb::Obj d_active; // gecacht; ändert nur in finishRebuild
+	};
+}
+
+#endif // __He_NativeIndex__
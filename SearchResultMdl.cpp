@@ -0,0 +1,299 @@
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "SearchResultMdl.h"
+#include "FullTextIndexer.h"
+#include "HeTypeDefs.h"
+#include <Oln2/OutlineUdbMdl.h>
+#include <Udb/Transaction.h>
+using namespace He;
+
+static const int s_pageSize = 64; // Zeilen, die auf einmal geladen werden
+
+SearchResultMdl::SearchResultMdl( FullTextIndexer* idx, QObject* p ):QAbstractItemModel(p),
+	d_idx(idx),d_order(FullTextIndexer::ByDateDesc)
+{
+	Q_ASSERT( idx != 0 );
+	connect( idx, SIGNAL(sigSearcherReset()), this, SLOT(onSearcherReset()) );
+}
+
+bool SearchResultMdl::setQuery( const QString& query )
+{
+	d_query = query;
+	return runQuery();
+}
+
+bool SearchResultMdl::runQuery()
+{
+	beginResetModel();
+	d_hits.clear();
+	d_rows.clear(); // vor dem search, da dieser den Searcher ersetzen kann
+	bool ok = true;
+	if( !d_query.isEmpty() )
+	{
+		ok = d_idx->search( d_query, d_order, d_hits );
+		if( ok )
+			d_rows.resize( d_hits->d_count ); // nur die Anzahl; noch kein Dokument geladen
+	}
+	endResetModel();
+	return ok;
+}
+
+void SearchResultMdl::clear()
+{
+	beginResetModel();
+	d_hits.clear();
+	d_rows.clear();
+	d_query.clear();
+	endResetModel();
+}
+
+void SearchResultMdl::onSearcherReset()
+{
+	if( d_rows.isEmpty() )
+		return;
+	// Die Dokumentnummern beziehen sich auf den alten Searcher
+	beginResetModel();
+	d_hits.clear(); // gibt auch die Lucene-Hits frei
+	d_rows.clear();
+	endResetModel();
+}
+
+void SearchResultMdl::fetchPage( int row ) const
+{
+	// Lädt die Seite der angefragten Zeile und die folgende, damit beim Scrollen schon vorgeladen ist
+	const int from = row - row % s_pageSize;
+	const int to = qMin( from + 2 * s_pageSize, d_rows.size() );
+	Udb::Transaction* txn = d_idx->getTxn();
+	for( int i = from; i < to; i++ )
+	{
+		Row& r = d_rows[i];
+		if( r.d_loaded )
+			continue;
+		QString sent;
+		if( !d_idx->fetchHit( d_hits, i, r.d_oid, sent ) )
+			return; // veraltet; onSearcherReset folgt
+		r.d_loaded = true;
+		r.d_score = d_hits->d_scores[i];
+		if( !sent.isEmpty() )
+			r.d_sent = sent.left( 8 ) + QLatin1Char('-') + sent.mid( 8, 4 );
+		Udb::Obj o = txn->getObject( r.d_oid );
+		if( !o.isNull() )
+		{
+			r.d_type = o.getType();
+			r.d_title = HeTypeDefs::formatObjectTitle( o );
+			if( r.d_type == TypeDocument )
+				r.d_title += tr(" (attached %1 times)").arg( FullTextIndexer::countReferences( o ) );
+		}else
+		{
+			r.d_oid = 0; // seit der letzten Indizierung gelöscht
+			r.d_title = tr("<deleted>");
+		}
+	}
+}
+
+void SearchResultMdl::fetchRefs( int row ) const
+{
+	if( !d_rows[row].d_loaded )
+		fetchPage( row );
+	Row& r = d_rows[row];
+	if( r.d_refsLoaded )
+		return;
+	r.d_refsLoaded = true;
+	if( r.d_type != TypeDocument )
+		return;
+	Udb::Transaction* txn = d_idx->getTxn();
+	foreach( const Udb::Obj& att, FullTextIndexer::findReferences( txn->getObject( r.d_oid ) ) )
+	{
+		const Udb::Obj mail = att.getParent();
+		Ref ref;
+		ref.d_oid = att.getOid();
+		ref.d_type = mail.getType();
+		ref.d_title = HeTypeDefs::formatObjectTitle( mail );
+		const QDateTime sent = mail.getValue( AttrSentOn ).getDateTime().toLocalTime();
+		if( sent.isValid() )
+			ref.d_sent = sent.toString( "yyyyMMdd-hhmm" );
+		r.d_refs.append( ref );
+	}
+}
+
+Udb::Obj SearchResultMdl::getObject( const QModelIndex& index ) const
+{
+	if( !index.isValid() )
+		return Udb::Obj();
+	if( index.internalId() != 0 )
+	{
+		// Unterzeile: das Attachment selber, damit die Mail angezeigt werden kann
+		const Row& r = d_rows[index.internalId() - 1];
+		return d_idx->getTxn()->getObject( r.d_refs[index.row()].d_oid );
+	}
+	if( index.row() >= d_rows.size() )
+		return Udb::Obj();
+	if( !d_rows[index.row()].d_loaded )
+		fetchPage( index.row() );
+	if( d_rows[index.row()].d_oid == 0 )
+		return Udb::Obj();
+	// Dokumente werden auf das Attachment abgebildet, damit die Mail angezeigt werden kann
+	return FullTextIndexer::resolveHit( d_idx->getTxn()->getObject( d_rows[index.row()].d_oid ) );
+}
+
+int SearchResultMdl::columnCount( const QModelIndex & parent ) const
+{
+	if( parent.isValid() && parent.internalId() != 0 )
+		return 0;
+	return ColCount;
+}
+
+int SearchResultMdl::rowCount( const QModelIndex & parent ) const
+{
+	if( !parent.isValid() )
+		return d_rows.size();
+	if( parent.internalId() != 0 || parent.column() != 0 || parent.row() >= d_rows.size() )
+		return 0;
+	if( !d_rows[parent.row()].d_loaded )
+		fetchPage( parent.row() );
+	fetchRefs( parent.row() );
+	return d_rows[parent.row()].d_refs.size();
+}
+
+bool SearchResultMdl::hasChildren( const QModelIndex & parent ) const
+{
+	// Ohne die Referenzen zu laden; ein Dokument hängt normalerweise an mindestens einer Mail
+	if( !parent.isValid() )
+		return !d_rows.isEmpty();
+	if( parent.internalId() != 0 || parent.column() != 0 || parent.row() >= d_rows.size() )
+		return false;
+	if( !d_rows[parent.row()].d_loaded )
+		fetchPage( parent.row() );
+	return d_rows[parent.row()].d_type == TypeDocument;
+}
+
+QModelIndex SearchResultMdl::index( int row, int column, const QModelIndex & parent ) const
+{
+	// internalId 0 für Treffer, sonst Zeile des Treffers + 1 für dessen Attachments
+	if( column < 0 || column >= ColCount || row < 0 )
+		return QModelIndex();
+	if( !parent.isValid() )
+	{
+		if( row < d_rows.size() )
+			return createIndex( row, column, quintptr(0) );
+	}else if( parent.internalId() == 0 && parent.row() < d_rows.size() )
+	{
+		fetchRefs( parent.row() );
+		if( row < d_rows[parent.row()].d_refs.size() )
+			return createIndex( row, column, quintptr( parent.row() + 1 ) );
+	}
+	return QModelIndex();
+}
+
+QModelIndex SearchResultMdl::parent( const QModelIndex & index ) const
+{
+	if( !index.isValid() || index.internalId() == 0 )
+		return QModelIndex();
+	return createIndex( int( index.internalId() - 1 ), 0, quintptr(0) );
+}
+
+Qt::ItemFlags SearchResultMdl::flags( const QModelIndex & ) const
+{
+	return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+}
+
+QVariant SearchResultMdl::data( const QModelIndex & index, int role ) const
+{
+	if( !index.isValid() )
+		return QVariant();
+	if( role != Qt::DisplayRole && role != Qt::ToolTipRole && role != Qt::DecorationRole )
+		return QVariant();
+	if( index.internalId() != 0 )
+	{
+		const Ref& ref = d_rows[index.internalId() - 1].d_refs[index.row()];
+		switch( index.column() )
+		{
+		case ObjectCol:
+			if( role == Qt::DecorationRole )
+				return ( ref.d_type != 0 ) ? QVariant( Oln::OutlineUdbMdl::getPixmap( ref.d_type ) ) : QVariant();
+			return ref.d_title;
+		case DateCol:
+			if( role == Qt::DecorationRole )
+				return QVariant();
+			return ref.d_sent;
+		}
+		return QVariant();
+	}
+	if( index.row() >= d_rows.size() )
+		return QVariant();
+	if( !d_rows[index.row()].d_loaded )
+		fetchPage( index.row() );
+	const Row& r = d_rows[index.row()];
+	switch( index.column() )
+	{
+	case ObjectCol:
+		if( role == Qt::DecorationRole )
+			return ( r.d_type != 0 ) ? QVariant( Oln::OutlineUdbMdl::getPixmap( r.d_type ) ) : QVariant();
+		return r.d_title;
+	case DateCol:
+		if( role == Qt::DecorationRole )
+			return QVariant();
+		return r.d_sent;
+	case ScoreCol:
+		if( role == Qt::DecorationRole || !r.d_loaded )
+			return QVariant();
+		return QString::number( r.d_score, 'f', 1 );
+	}
+	return QVariant();
+}
+
+QVariant SearchResultMdl::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+	switch( section )
+	{
+	case ObjectCol:
+		return tr("Object");
+	case DateCol:
+		return tr("Sent");
+	case ScoreCol:
+		return tr("Score");
+	}
+	return QVariant();
+}
+
+void SearchResultMdl::sort( int column, Qt::SortOrder order )
+{
+	// Sortiert wird in Lucene; nach Objekt-Titel geht nicht ohne alle Hits zu laden
+	int o;
+	switch( column )
+	{
+	case DateCol:
+		o = ( order == Qt::DescendingOrder ) ? FullTextIndexer::ByDateDesc : FullTextIndexer::ByDateAsc;
+		break;
+	case ScoreCol:
+		o = FullTextIndexer::ByScore;
+		break;
+	default:
+		return;
+	}
+	if( o == d_order )
+		return;
+	d_order = o;
+	if( !d_query.isEmpty() )
+		runQuery();
+}
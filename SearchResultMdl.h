@@ -0,0 +1,91 @@
+#ifndef __He_SearchResultMdl__
+#define __He_SearchResultMdl__
+
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QAbstractItemModel>
+#include <QVector>
+#include <Udb/Obj.h>
+#include "FullTextIndexer.h"
+
+namespace He
+{
+	// Zeigt die Hits eines Queries, ohne sie vorher alle zu laden. Dokument und Udb::Obj werden
+	// seitenweise erst geladen, wenn die View eine Zeile anzeigt. Die Dokumentnummern kommen
+	// aus FullTextIndexer::search, evtl. aus dem Cache. Ein TypeDocument-Treffer hat die Attachments,
+	// die darauf verweisen, als Unterzeilen.
+	class SearchResultMdl : public QAbstractItemModel
+	{
+		Q_OBJECT
+	public:
+		enum Column { ObjectCol, DateCol, ScoreCol, ColCount };
+
+		SearchResultMdl( FullTextIndexer*, QObject* );
+
+		bool setQuery( const QString& ); // false bei Fehler, siehe FullTextIndexer::getError
+		void clear();
+		int getHitCount() const { return d_rows.size(); }
+		Udb::Obj getObject( const QModelIndex& ) const;
+
+		// Overrides
+		int columnCount( const QModelIndex & parent = QModelIndex() ) const;
+		int rowCount( const QModelIndex & parent = QModelIndex() ) const;
+		QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const;
+		QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const;
+		QModelIndex index( int row, int column, const QModelIndex & parent = QModelIndex() ) const;
+		QModelIndex parent( const QModelIndex & ) const;
+		bool hasChildren( const QModelIndex & parent = QModelIndex() ) const;
+		Qt::ItemFlags flags( const QModelIndex & index ) const;
+		void sort( int column, Qt::SortOrder order = Qt::AscendingOrder );
+	protected slots:
+		void onSearcherReset();
+	protected:
+		bool runQuery();
+		void fetchPage( int row ) const;
+		void fetchRefs( int row ) const;
+	private:
+		struct Ref // Attachment eines TypeDocument-Treffers, als Unterzeile
+		{
+			Udb::OID d_oid;
+			QString d_title; // der Mail
+			QString d_sent;
+			quint32 d_type; // der Mail
+		};
+		struct Row
+		{
+			Udb::OID d_oid;
+			QString d_title;
+			QString d_sent; // yyyyMMdd-hhmm
+			float d_score;
+			quint32 d_type;
+			bool d_loaded;
+			bool d_refsLoaded;
+			QList<Ref> d_refs; // nur für TypeDocument, neuste Mail zuerst
+			Row():d_oid(0),d_score(0),d_type(0),d_loaded(false),d_refsLoaded(false){}
+		};
+		FullTextIndexer* d_idx;
+		QString d_query;
+		int d_order; // FullTextIndexer::Order
+		FullTextIndexer::HitRef d_hits;
+		mutable QVector<Row> d_rows; // Grösse = Anzahl Hits, nur d_loaded Einträge sind gefüllt
+	};
+}
+
+#endif
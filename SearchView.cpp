@@ -20,10 +20,11 @@
 #include "SearchView.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QTreeWidget>
+#include <QTreeView>
 #include <QLineEdit>
 #include <QPushButton>
 #include <QMessageBox>
+#include <QInputDialog>
 #include <QApplication>
 #include <QShortcut>
 #include <QLabel>
@@ -34,40 +35,11 @@
 #include <GuiTools/UiFunction.h>
 #include <Oln2/OutlineUdbMdl.h>
 #include "FullTextIndexer.h"
+#include "SearchResultMdl.h"
 #include "HeraldApp.h"
 #include "HeTypeDefs.h"
 using namespace He;
 
-static const int s_objectCol = 0;
-static const int s_dateCol = 1;
-static const int s_scoreCol = 2;
-
-struct _SearchViewItem : public QTreeWidgetItem
-{
-	_SearchViewItem( QTreeWidget* w ):QTreeWidgetItem( w ) {}
-
-	bool operator<(const QTreeWidgetItem &other) const
-	{
-		const int col = treeWidget()->sortColumn();
-		switch( col )
-		{
-		case s_scoreCol:
-			return text(s_scoreCol) < other.text(s_scoreCol);
-		case s_objectCol:
-			return text(s_objectCol) < other.text(s_objectCol);
-		case s_dateCol:
-			return text(s_dateCol) + text(s_scoreCol) < other.text(s_dateCol) + other.text(s_scoreCol );
-		}
-		return text(col) < other.text(col);
-	}
-	QVariant data(int column, int role) const
-	{
-		if( role == Qt::ToolTipRole )
-			role = Qt::DisplayRole;
-		return QTreeWidgetItem::data( column, role );
-	}
-};
-
 SearchView::SearchView(Udb::Transaction* txn, QWidget * p):QWidget( p )
 {
 	setWindowTitle( tr("Herald Search") );
@@ -93,39 +65,50 @@ SearchView::SearchView(Udb::Transaction* txn, QWidget * p):QWidget( p )
 	connect( doit, SIGNAL( clicked() ), this, SLOT( onSearch() ) );
 	hbox->addWidget( doit );
 
-	d_result = new QTreeWidget( this );
-	d_result->setHeaderLabels( QStringList() << tr("Object") << tr("Sent") << tr("Score") ); // s_item, s_doc, s_score
+	d_count = new QLabel( this );
+	hbox->addWidget( d_count );
+
+	d_behind = new QLabel( this );
+	d_behind->setVisible( false );
+	hbox->addWidget( d_behind );
+	connect( d_idx, SIGNAL(sigPendingCount(int)), this, SLOT(onPendingCount(int)) );
+	connect( d_idx, SIGNAL(sigError(QString)), this, SLOT(onIndexError(QString)) );
+	onPendingCount( d_idx->getPendingCount() );
+
+	d_mdl = new SearchResultMdl( d_idx, this );
+	// nach dem Modell verbinden, damit dieses schon geleert ist
+	connect( d_idx, SIGNAL(sigSearcherReset()), this, SLOT(onSearcherReset()) );
+	d_result = new QTreeView( this );
+	d_result->setModel( d_mdl );
 	d_result->header()->setStretchLastSection( false );
+	d_result->header()->setSectionResizeMode( SearchResultMdl::ObjectCol, QHeaderView::Stretch );
+	d_result->header()->setSectionResizeMode( SearchResultMdl::DateCol, QHeaderView::ResizeToContents );
+	d_result->header()->setSectionResizeMode( SearchResultMdl::ScoreCol, QHeaderView::ResizeToContents );
 	d_result->setAllColumnsShowFocus( true );
-	d_result->setRootIsDecorated( false );
+	d_result->setRootIsDecorated( true ); // Dokumente zeigen ihre Attachments
+	d_result->setUniformRowHeights( true ); // sonst fragt die View alle Zeilen ab
+	d_sortCol = SearchResultMdl::DateCol;
+	d_sortOrder = Qt::DescendingOrder;
+	d_result->sortByColumn( d_sortCol, d_sortOrder );
 	d_result->setSortingEnabled(true);
+	connect( d_result->header(), SIGNAL(sortIndicatorChanged(int,Qt::SortOrder)),
+			 this, SLOT(onSortIndicator(int,Qt::SortOrder)) );
 	QPalette pal = d_result->palette();
 	pal.setColor( QPalette::AlternateBase, QColor::fromRgb( 245, 245, 245 ) );
 	d_result->setPalette( pal );
 	d_result->setAlternatingRowColors( true );
-	connect( d_result, SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ), this, SLOT( onGotoImp() ) );
-	connect( d_result, SIGNAL( itemDoubleClicked ( QTreeWidgetItem *, int ) ), this, SLOT( onGotoImp() ) );
+	connect( d_result, SIGNAL( activated ( QModelIndex ) ), this, SLOT( onGotoImp() ) );
+	connect( d_result, SIGNAL( doubleClicked ( QModelIndex ) ), this, SLOT( onGotoImp() ) );
 	vbox->addWidget( d_result );
 }
 
-static QString _valuta( const Udb::Obj& o )
-{
-	Stream::DataCell v = o.getValue( AttrSentOn );
-    if( !v.isDateTime() && !o.getParent().isNull() )
-		v = o.getParent().getValue( AttrSentOn );
-	if( v.isDateTime() )
-		return v.getDateTime().toLocalTime().toString( "yyyyMMdd-hhmm " );
-	else
-		return QString();
-}
-
 void SearchView::onSearch()
 {
-	FullTextIndexer::ResultList res;
 	if( !d_idx->exists() )
 	{
 		if( QMessageBox::question( this, tr("Herald Search"), 
-			tr("The index does not yet exist. Do you want to build it? This will take some minutes." ),
+			tr("The index does not yet exist or is from an older version. Do you want to build it? "
+			   "This will take some minutes." ),
 			QMessageBox::Ok | QMessageBox::Cancel ) == QMessageBox::Cancel )
 			return;
 		if( !d_idx->indexDatabase( this ) )
@@ -134,47 +117,22 @@ void SearchView::onSearch()
 				QMessageBox::critical( this, tr("Herald Indexer"), d_idx->getError() );
 			return;
 		}
-	}else if( d_idx->hasPendingUpdates() )
-	{
-		// Immer aktualisieren ohne zu fragen
-		if( true ) /*QMessageBox::question( this, tr("Herald Search"), 
-			tr("The index is not up-do-date. Do you want to update it?" ),
-			QMessageBox::Ok | QMessageBox::Cancel ) == QMessageBox::Ok )*/
-		{
-			if( !d_idx->indexIncrements( this ) )
-			{
-				if( !d_idx->getError().isEmpty() )
-					QMessageBox::critical( this, tr("Herald Indexer"), d_idx->getError() );
-				return;
-			}
-		}
 	}
+	// Ausstehende Änderungen werden im Hintergrund indiziert; die Suche wartet nicht darauf.
+	// Es werden nur die Treffer gezählt; die Dokumente lädt das Modell für die sichtbaren Zeilen.
 	QApplication::setOverrideCursor( Qt::WaitCursor );
-	if( !d_idx->query( d_query->text(), res ) )
+	const bool ok = d_mdl->setQuery( d_query->text() );
+	QApplication::restoreOverrideCursor();
+	if( !ok )
 	{
-		QApplication::restoreOverrideCursor();
+		d_count->clear();
 		QMessageBox::critical( this, tr("Herald Search"), d_idx->getError() );
 		return;
 	}
-	d_result->clear();
-	for( int i = 0; i < res.size(); i++ )
-	{
-		QTreeWidgetItem* item = new _SearchViewItem( d_result );
-		const QString text = HeTypeDefs::formatObjectTitle( res[i].d_object );
-		item->setText( s_objectCol, text );
-		item->setData( s_objectCol, Qt::UserRole, res[i].d_object.getOid() );
-		item->setText( s_dateCol, _valuta( res[i].d_object ) );
-		item->setIcon( s_objectCol, Oln::OutlineUdbMdl::getPixmap( res[i].d_object.getType() ) );
-		item->setText( s_scoreCol, QString::number( res[i].d_score, 'f', 1 ) );
-	}
-    d_result->header()->setSectionResizeMode( s_objectCol, QHeaderView::Stretch );
-    d_result->header()->setSectionResizeMode( s_dateCol, QHeaderView::ResizeToContents );
-    d_result->header()->setSectionResizeMode( s_scoreCol, QHeaderView::ResizeToContents );
-	d_result->resizeColumnToContents( s_scoreCol );
-    d_result->resizeColumnToContents( s_dateCol );
-	d_result->sortByColumn( s_dateCol, Qt::DescendingOrder );
-    d_result->scrollToItem( d_result->topLevelItem( 0 ) );
-	QApplication::restoreOverrideCursor();
+	d_count->setText( tr("%1 hits").arg( d_mdl->getHitCount() ) );
+	d_count->setToolTip( tr("query cache: %1 reused, %2 narrowed").arg( d_idx->getCacheHits() ).
+						 arg( d_idx->getCacheNarrowed() ) );
+	d_result->scrollToTop();
 }
 
 void SearchView::onNew()
@@ -185,37 +143,33 @@ void SearchView::onNew()
 
 void SearchView::onGotoImp()
 {
-	QTreeWidgetItem* cur = d_result->currentItem();
-	if( cur == 0 )
+	Udb::Obj o = getItem();
+	if( o.isNull() )
 		return;
 
-	emit signalShowItem( d_idx->getTxn()->getObject( cur->data( s_objectCol,Qt::UserRole).toULongLong() ) );
+	emit signalShowItem( o );
 }
 
 void SearchView::onGoto()
 {
-	ENABLED_IF( d_result->currentItem() );
+	ENABLED_IF( !getItem().isNull() );
 	onGotoImp();
 }
 
 void SearchView::onCopyRef()
 {
-	ENABLED_IF( d_result->currentItem() );
+	Udb::Obj o = getItem();
+	ENABLED_IF( !o.isNull() );
 
     QMimeData* mimeData = new QMimeData();
     QList<Udb::Obj> objs;
-    objs.append( d_idx->getTxn()->
-                 getObject( d_result->currentItem()->data( s_objectCol,Qt::UserRole).toULongLong() ) );
+    objs.append( o );
     HeTypeDefs::writeObjectRefs( mimeData, objs );
 }
 
 Udb::Obj SearchView::getItem() const
 {
-	QTreeWidgetItem* cur = d_result->currentItem();
-	if( cur == 0 )
-        return Udb::Obj();
-	else
-		return d_idx->getTxn()->getObject( cur->data( s_objectCol,Qt::UserRole).toULongLong() );
+	return d_mdl->getObject( d_result->currentIndex() );
 }
 
 void SearchView::onRebuildIndex()
@@ -234,18 +188,103 @@ void SearchView::onUpdateIndex()
 {
 	ENABLED_IF( d_idx->exists() && d_idx->hasPendingUpdates() );
 
-	if( !d_idx->indexIncrements( this ) )
-	{
-		if( !d_idx->getError().isEmpty() )
-			QMessageBox::critical( this, tr("Herald Indexer"), d_idx->getError() );
-	}
+	d_idx->indexIncrements( this );
+}
+
+void SearchView::onOptimizeIndex()
+{
+	ENABLED_IF( d_idx->exists() );
+
+	d_idx->optimize();
+}
+
+void SearchView::onIndexStats()
+{
+	ENABLED_IF( true );
+
+	const FullTextIndexer::Stats st = d_idx->getStats();
+	QString last = tr("never");
+	if( st.d_lastOptimize.isValid() )
+		last = st.d_lastOptimize.toString( Qt::DefaultLocaleShortDate );
+	QMessageBox::information( this, tr("Herald Index Statistics"),
+		tr("Path: %1\n"
+		   "Size: %2 MB\n"
+		   "Segments: %3\n"
+		   "Documents: %4\n"
+		   "Deleted documents: %5 (%6%)\n"
+		   "Pending updates: %7\n"
+		   "Last optimize: %8\n"
+		   "Query cache: %9 reused, %10 narrowed").
+		arg( d_idx->getIndexPath() ).
+		arg( st.d_size / 1024.0 / 1024.0, 0, 'f', 1 ).
+		arg( st.d_segments ).
+		arg( st.d_docs ).
+		arg( st.d_maxDoc - st.d_docs ).arg( st.getDeletedRatio() * 100.0, 0, 'f', 1 ).
+		arg( st.d_pending ).
+		arg( last ).
+		arg( d_idx->getCacheHits() ).arg( d_idx->getCacheNarrowed() ) );
+}
+
+void SearchView::onIndexBenchmark()
+{
+	ENABLED_IF( d_idx->exists() );
+
+	// Dieselben Queries mit einem Build mit und einem ohne Lucene laufen lassen und vergleichen
+	QSettings* set = HeraldApp::inst()->getSet();
+	bool ok;
+	const QString queries = QInputDialog::getText( this, tr("Herald Index Benchmark"),
+		tr("Queries (separated by ';'):"), QLineEdit::Normal,
+		set->value( "FullText/BenchQueries", "meeting; invoice AND 2024; type:inbound budget" ).toString(), &ok );
+	if( !ok || queries.trimmed().isEmpty() )
+		return;
+	set->setValue( "FullText/BenchQueries", queries );
+	QApplication::setOverrideCursor( Qt::WaitCursor );
+	const QString res = d_idx->benchmark( queries.split( QLatin1Char(';'), QString::SkipEmptyParts ) );
+	QApplication::restoreOverrideCursor();
+	QMessageBox::information( this, tr("Herald Index Benchmark"), res );
 }
 
 void SearchView::onClearSearch()
 {
-	ENABLED_IF( d_result->topLevelItemCount() > 0 );
+	ENABLED_IF( d_mdl->rowCount() > 0 );
 
-	d_result->clear();
+	d_mdl->clear();
+	d_count->clear();
 	d_query->clear();
 	d_query->setFocus();
 }
+
+void SearchView::onPendingCount(int n)
+{
+	d_behind->setVisible( n > 0 );
+	d_behind->setText( tr("index %1 behind").arg( n ) );
+	d_behind->setToolTip( tr("%1 journal writes saved by coalescing").arg( d_idx->getWritesSaved() ) );
+}
+
+void SearchView::onSortIndicator( int col, Qt::SortOrder order )
+{
+	// Nach Objekt sortiert SearchResultMdl nicht; dann den bisherigen Indikator wiederherstellen
+	if( col == SearchResultMdl::ObjectCol )
+	{
+		d_result->header()->setSortIndicator( d_sortCol, d_sortOrder );
+		return;
+	}
+	d_sortCol = col;
+	d_sortOrder = order;
+}
+
+void SearchView::onSearcherReset()
+{
+	// Das Modell hat seine Treffer verworfen; die Anzahl stimmt nicht mehr
+	if( d_count->text().isEmpty() )
+		return;
+	d_count->setText( tr("index changed, search again") );
+	d_count->setToolTip( QString() );
+}
+
+void SearchView::onIndexError(const QString & msg)
+{
+	d_behind->setVisible( true );
+	d_behind->setText( tr("index error") );
+	d_behind->setToolTip( msg );
+}
@@ -23,12 +23,14 @@
 #include <QWidget>
 #include <Udb/Transaction.h>
 
-class QTreeWidget;
+class QTreeView;
 class QLineEdit;
+class QLabel;
 
 namespace He
 {
 	class FullTextIndexer;
+	class SearchResultMdl;
 
 	class SearchView : public QWidget
 	{
@@ -44,13 +46,26 @@ namespace He
 		void onGoto();
 		void onRebuildIndex();
 		void onUpdateIndex();
+		void onOptimizeIndex();
+		void onIndexStats();
+		void onIndexBenchmark();
 		void onGotoImp();
 		void onClearSearch();
 		void onCopyRef();
+	protected slots:
+		void onPendingCount( int );
+		void onIndexError( const QString& );
+		void onSearcherReset();
+		void onSortIndicator( int, Qt::SortOrder );
 	private:
 		QLineEdit* d_query;
-		QTreeWidget* d_result;
+		QLabel* d_count;
+		QLabel* d_behind;
+		QTreeView* d_result;
+		SearchResultMdl* d_mdl;
 		FullTextIndexer* d_idx;
+		int d_sortCol; // letzte gültige Sortierung, siehe onSortIndicator
+		Qt::SortOrder d_sortOrder;
 	};
 }
 
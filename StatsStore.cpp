@@ -0,0 +1,339 @@
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StatsStore.h"
+#include <Sqlite3/sqlite3.h>
+#include <Udb/Transaction.h>
+#include <Udb/Database.h>
+#include <Udb/Idx.h>
+#include <QFileInfo>
+#include <QDir>
+#include <QHash>
+#include <QSettings>
+#include <QtDebug>
+#include "HeTypeDefs.h"
+#include "HeraldApp.h"
+#include "MailObj.h"
+using namespace He;
+
+static const char* s_schema = "1"; // erhöhen, wenn sich die Tabelle ändert; erzwingt einen Rebuild
+
+StatsStore::StatsStore( Udb::Transaction* txn, QObject* parent ):QObject( parent ),
+	d_txn( txn ),d_db(0),d_insert(0),d_remove(0),d_complete(false)
+{
+	Q_ASSERT( txn != 0 );
+	txn->addObserver( this, SLOT(onDbUpdate( Udb::UpdateInfo ) ), false );
+	open();
+}
+
+StatsStore::~StatsStore()
+{
+	close();
+}
+
+QString StatsStore::getStorePath() const
+{
+	QFileInfo info( d_txn->getDb()->getFilePath() );
+	return info.absoluteDir().absoluteFilePath( info.completeBaseName() + QLatin1String( ".stats" ) );
+}
+
+bool StatsStore::isEnabled()
+{
+	return HeraldApp::inst()->getSet()->value( "Statistics/Enabled", false ).toBool();
+}
+
+void StatsStore::setEnabled( bool on )
+{
+	HeraldApp::inst()->getSet()->setValue( "Statistics/Enabled", on );
+}
+
+bool StatsStore::open()
+{
+	if( d_db != 0 )
+		return true;
+	if( !isEnabled() )
+		return false;
+	d_error.clear();
+	if( sqlite3_open_v2( getStorePath().toUtf8(), &d_db,
+						 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0 ) != SQLITE_OK )
+	{
+		fail( "open" );
+		return false;
+	}
+	// Der Store lässt sich jederzeit aus Udb neu erstellen; darum genügt WAL ohne fsync pro Commit
+	exec( "PRAGMA journal_mode=WAL" );
+	exec( "PRAGMA synchronous=NORMAL" );
+	if( !exec( "CREATE TABLE IF NOT EXISTS meta( key TEXT PRIMARY KEY, value TEXT )" ) ||
+		!exec( "CREATE TABLE IF NOT EXISTS messages( oid INTEGER PRIMARY KEY, sent TEXT, "
+			   "sender TEXT, subject TEXT, type INTEGER, size INTEGER )" ) ||
+		!exec( "CREATE INDEX IF NOT EXISTS messages_sent ON messages( sent )" ) ||
+		!exec( "CREATE INDEX IF NOT EXISTS messages_sender ON messages( sender )" ) )
+		return false;
+	if( sqlite3_prepare_v2( d_db, "INSERT OR REPLACE INTO messages VALUES( ?, ?, ?, ?, ?, ? )",
+							-1, &d_insert, 0 ) != SQLITE_OK ||
+		sqlite3_prepare_v2( d_db, "DELETE FROM messages WHERE oid = ?", -1, &d_remove, 0 ) != SQLITE_OK )
+	{
+		fail( "prepare" );
+		return false;
+	}
+	const QString db = d_txn->getDb()->getDbUuid().toString();
+	if( getMeta( "schema" ) != QLatin1String( s_schema ) || getMeta( "db" ) != db )
+	{
+		// Neue Datei, älteres Format oder eine Kopie, die zu einer anderen .hedb gehört
+		if( !exec( "DELETE FROM messages" ) )
+			return false;
+		setMeta( "schema", QLatin1String( s_schema ) );
+		setMeta( "db", db );
+		setMeta( "complete", QLatin1String( "0" ) );
+	}
+	d_complete = getMeta( "complete" ) == QLatin1String( "1" );
+	return isOpen();
+}
+
+void StatsStore::close()
+{
+	if( d_db == 0 )
+		return;
+	sqlite3_finalize( d_insert );
+	sqlite3_finalize( d_remove );
+	d_insert = 0;
+	d_remove = 0;
+	sqlite3_close( d_db );
+	d_db = 0;
+	d_complete = false;
+}
+
+bool StatsStore::exec( const char* sql )
+{
+	if( d_db == 0 )
+		return false;
+	if( sqlite3_exec( d_db, sql, 0, 0, 0 ) != SQLITE_OK )
+	{
+		fail( sql );
+		return false;
+	}
+	return true;
+}
+
+void StatsStore::fail( const char* where )
+{
+	d_error = QString( "%1: %2" ).arg( where ).arg( QString::fromUtf8( sqlite3_errmsg( d_db ) ) );
+	qWarning() << "StatsStore:" << d_error;
+	// Ein Store mit unbekanntem Stand ist wertlos; beim nächsten open() wird er neu aufgebaut
+	if( d_db != 0 )
+	{
+		sqlite3_exec( d_db, "ROLLBACK", 0, 0, 0 );
+		sqlite3_exec( d_db, "UPDATE meta SET value = '0' WHERE key = 'complete'", 0, 0, 0 );
+	}
+	close();
+}
+
+void StatsStore::setMeta( const char* key, const QString& value )
+{
+	sqlite3_stmt* st = 0;
+	if( sqlite3_prepare_v2( d_db, "INSERT OR REPLACE INTO meta VALUES( ?, ? )", -1, &st, 0 ) != SQLITE_OK )
+		return;
+	const QByteArray v = value.toUtf8();
+	sqlite3_bind_text( st, 1, key, -1, SQLITE_STATIC );
+	sqlite3_bind_text( st, 2, v.constData(), v.size(), SQLITE_TRANSIENT );
+	sqlite3_step( st );
+	sqlite3_finalize( st );
+}
+
+QString StatsStore::getMeta( const char* key ) const
+{
+	sqlite3_stmt* st = 0;
+	if( sqlite3_prepare_v2( d_db, "SELECT value FROM meta WHERE key = ?", -1, &st, 0 ) != SQLITE_OK )
+		return QString();
+	sqlite3_bind_text( st, 1, key, -1, SQLITE_STATIC );
+	QString res;
+	if( sqlite3_step( st ) == SQLITE_ROW )
+		res = QString::fromUtf8( (const char*)sqlite3_column_text( st, 0 ) );
+	sqlite3_finalize( st );
+	return res;
+}
+
+static inline bool _isMessage( quint32 type )
+{
+	return type == TypeInboundMessage || type == TypeOutboundMessage;
+}
+
+bool StatsStore::writeMessage( const Udb::Obj& o )
+{
+	MailObj mail = o;
+	// sent in lokaler Zeit, damit Monate so gruppiert werden, wie sie der User in den Listen sieht
+	const QByteArray sent = mail.getLocalSentOn().toString( "yyyy-MM-dd hh:mm:ss" ).toUtf8();
+	const QByteArray sender = mail.getFrom( false ).d_addr.toLower();
+	const QByteArray subject = mail.getString( AttrText ).toUtf8();
+	// Grösse wie gespeichert: Header und Body plus die Attachment-Dateien
+	qint64 size = mail.getString( AttrRawHeaders ).size() + mail.getString( AttrBody ).size();
+	if( mail.getValue( AttrAttCount ).getUInt32() > 0 )
+	{
+		MailObj::Attachments atts = mail.getAttachments();
+		for( int i = 0; i < atts.size(); i++ )
+		{
+			if( !atts[i].getValueAsObj( AttrDocumentRef ).isNull() )
+				size += QFileInfo( atts[i].getDocumentPath() ).size();
+		}
+	}
+	sqlite3_reset( d_insert );
+	sqlite3_bind_int64( d_insert, 1, mail.getOid() );
+	if( sent.isEmpty() )
+		sqlite3_bind_null( d_insert, 2 );
+	else
+		sqlite3_bind_text( d_insert, 2, sent.constData(), sent.size(), SQLITE_TRANSIENT );
+	sqlite3_bind_text( d_insert, 3, sender.constData(), sender.size(), SQLITE_TRANSIENT );
+	sqlite3_bind_text( d_insert, 4, subject.constData(), subject.size(), SQLITE_TRANSIENT );
+	sqlite3_bind_int( d_insert, 5, mail.getType() );
+	sqlite3_bind_int64( d_insert, 6, size );
+	if( sqlite3_step( d_insert ) != SQLITE_DONE )
+	{
+		fail( "insert" );
+		return false;
+	}
+	return true;
+}
+
+bool StatsStore::removeMessage( Udb::OID oid )
+{
+	sqlite3_reset( d_remove );
+	sqlite3_bind_int64( d_remove, 1, oid );
+	if( sqlite3_step( d_remove ) != SQLITE_DONE )
+	{
+		fail( "delete" );
+		return false;
+	}
+	return true;
+}
+
+bool StatsStore::rebuild()
+{
+	if( !open() )
+		return false;
+	if( !exec( "BEGIN" ) || !exec( "DELETE FROM messages" ) )
+		return false;
+	Udb::Idx idx( d_txn, IndexDefs::IdxSentOn );
+	if( idx.first() ) do
+	{
+		Udb::Obj mail = d_txn->getObject( idx.getOid() );
+		if( _isMessage( mail.getType() ) && !writeMessage( mail ) )
+			return false;
+	}while( idx.next() );
+	setMeta( "complete", QLatin1String( "1" ) );
+	if( !exec( "COMMIT" ) )
+		return false;
+	d_complete = true;
+	return true;
+}
+
+qint64 StatsStore::getMessageCount() const
+{
+	if( d_db == 0 )
+		return 0;
+	sqlite3_stmt* st = 0;
+	if( sqlite3_prepare_v2( d_db, "SELECT COUNT(*) FROM messages", -1, &st, 0 ) != SQLITE_OK )
+		return 0;
+	qint64 res = 0;
+	if( sqlite3_step( st ) == SQLITE_ROW )
+		res = sqlite3_column_int64( st, 0 );
+	sqlite3_finalize( st );
+	return res;
+}
+
+QList<StatsStore::Count> StatsStore::countBy( Group g, int limit ) const
+{
+	QList<Count> res;
+	if( d_db == 0 )
+		return res;
+	const char* sql = 0;
+	switch( g )
+	{
+	case BySender:
+		sql = "SELECT sender, COUNT(*), SUM(size) FROM messages GROUP BY 1 ORDER BY 2 DESC, 1 LIMIT ?";
+		break;
+	case ByMonth:
+		sql = "SELECT substr(sent,1,7), COUNT(*), SUM(size) FROM messages GROUP BY 1 ORDER BY 1 DESC LIMIT ?";
+		break;
+	case ByYear:
+		sql = "SELECT substr(sent,1,4), COUNT(*), SUM(size) FROM messages GROUP BY 1 ORDER BY 1 DESC LIMIT ?";
+		break;
+	case ByType:
+		sql = "SELECT type, COUNT(*), SUM(size) FROM messages GROUP BY 1 ORDER BY 2 DESC LIMIT ?";
+		break;
+	}
+	sqlite3_stmt* st = 0;
+	if( sqlite3_prepare_v2( d_db, sql, -1, &st, 0 ) != SQLITE_OK )
+		return res;
+	sqlite3_bind_int( st, 1, ( limit > 0 ) ? limit : -1 );
+	while( sqlite3_step( st ) == SQLITE_ROW )
+	{
+		Count c;
+		c.d_key = QString::fromUtf8( (const char*)sqlite3_column_text( st, 0 ) );
+		c.d_count = sqlite3_column_int64( st, 1 );
+		c.d_size = sqlite3_column_int64( st, 2 );
+		res.append( c );
+	}
+	sqlite3_finalize( st );
+	return res;
+}
+
+void StatsStore::onDbUpdate( const Udb::UpdateInfo& info )
+{
+	if( info.d_kind != Udb::UpdateInfo::PreCommit || d_db == 0 )
+		return;
+
+	// mache hier eine richtige Kopie, analog zu AddressIndexer
+	QList<Udb::UpdateInfo> updates = d_txn->getPendingNotifications();
+	// pro OID zählt die letzte Änderung (true..neu schreiben, false..gelöscht)
+	QHash<Udb::OID,bool> dirty;
+	for( int i = 0; i < updates.size(); i++ )
+	{
+		const Udb::UpdateInfo& upd = updates[i];
+		if( upd.d_kind == Udb::UpdateInfo::ValueChanged )
+		{
+			if( upd.d_name == AttrSentOn || upd.d_name == AttrText || upd.d_name == AttrBody ||
+					upd.d_name == AttrRawHeaders || upd.d_name == AttrAttCount )
+			{
+				if( _isMessage( d_txn->getObject( upd.d_id ).getType() ) )
+					dirty[upd.d_id] = true;
+			}else if( upd.d_name == AttrPartyAddr )
+			{
+				Udb::Obj party = d_txn->getObject( upd.d_id );
+				if( party.getType() == TypeFromParty && _isMessage( party.getParent().getType() ) )
+					dirty[party.getParent().getOid()] = true;
+			}
+		}else if( upd.d_kind == Udb::UpdateInfo::ObjectErased && _isMessage( upd.d_name ) )
+			dirty[upd.d_id] = false;
+	}
+	if( dirty.isEmpty() )
+		return;
+
+	// NOTE: die Udb-Transaction ist hier noch offen; der Store wird vorher geschrieben. Schlägt der
+	// Udb-Commit danach fehl, bringt erst ein rebuild() den Store wieder in Übereinstimmung.
+	if( !exec( "BEGIN" ) )
+		return;
+	QHash<Udb::OID,bool>::const_iterator i;
+	for( i = dirty.begin(); i != dirty.end(); ++i )
+	{
+		const bool ok = ( i.value() ) ? writeMessage( d_txn->getObject( i.key() ) ) : removeMessage( i.key() );
+		if( !ok )
+			return;
+	}
+	exec( "COMMIT" );
+}
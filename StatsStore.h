@@ -0,0 +1,81 @@
+#ifndef __He_StatsStore__
+#define __He_StatsStore__
+
+/*
+* Copyright 2013-2025 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Herald application.
+*
+* The following is the license that applies to this copy of the
+* application. For a license to use the application under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QList>
+#include <Udb/Obj.h>
+#include <Udb/UpdateInfo.h>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace He
+{
+	// Optionale Sqlite-Datenbank neben der .hedb mit einer denormalisierten Tabelle aller Messages
+	// (oid, sent, sender, subject, type, size) für Auswertungen, die in Udb einen Durchlauf über
+	// IdxSentOn bräuchten. Wird in PreCommit nachgeführt; kann jederzeit aus Udb neu erstellt werden.
+	class StatsStore : public QObject
+	{
+		Q_OBJECT
+	public:
+		enum Group { BySender, ByMonth, ByYear, ByType };
+		struct Count
+		{
+			QString d_key;
+			qint64 d_count;
+			qint64 d_size;
+			Count():d_count(0),d_size(0){}
+		};
+
+		explicit StatsStore( Udb::Transaction*, QObject* parent = 0 );
+		~StatsStore();
+		QString getStorePath() const;
+		static bool isEnabled(); // Setting "Statistics/Enabled"
+		static void setEnabled( bool );
+		bool open(); // öffnet bzw. erstellt die Datei; ohne isEnabled() bleibt der Store zu
+		void close();
+		bool isOpen() const { return d_db != 0; }
+		bool isComplete() const { return d_complete; } // false bis zum ersten rebuild()
+		bool rebuild();
+		qint64 getMessageCount() const;
+		QList<Count> countBy( Group, int limit = 0 ) const;
+		const QString& getError() const { return d_error; }
+	protected slots:
+		void onDbUpdate( const Udb::UpdateInfo& );
+	protected:
+		bool exec( const char* sql );
+		bool writeMessage( const Udb::Obj& );
+		bool removeMessage( Udb::OID );
+		void setMeta( const char* key, const QString& value );
+		QString getMeta( const char* key ) const;
+		void fail( const char* where );
+	private:
+		Udb::Transaction* d_txn;
+		sqlite3* d_db;
+		sqlite3_stmt* d_insert;
+		sqlite3_stmt* d_remove;
+		QString d_error;
+		bool d_complete;
+	};
+}
+
+#endif // __He_StatsStore__
@@ -31,6 +31,7 @@
 #include <Udb/Idx.h>
 #include "HeTypeDefs.h"
 #include "MailObj.h"
+#include "AddressCache.h"
 #include "MailTextEdit.h"
 #include "ObjectHelper.h"
 using namespace He;
@@ -247,7 +248,11 @@ void UploadManager::onUploadCommitted(MailMessage * msg)
                 if( MailObj::acceptDraftParty( draftParty, msg ) )
                     d_txn->commit();
                 else
+                {
                     d_txn->rollback();
+                    AddressCache::discard( d_txn );
+                    PendingCache::discard( d_txn );
+                }
             }else
                 qWarning() << "UploadManager::onUploadCommitted: unknown party oid or type" << draftParty.getOid();
         }else
@@ -264,7 +269,11 @@ void UploadManager::onUploadCommitted(MailMessage * msg)
                     if( !o.isNull() )
                         d_txn->commit();
                     else
+                    {
                         d_txn->rollback();
+                        AddressCache::discard( d_txn );
+                        PendingCache::discard( d_txn );
+                    }
                 }else
                     qWarning() << "UploadManager::onUploadCommitted: unknown message oid or type" << idx.getOid();
             }else